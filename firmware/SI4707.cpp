@@ -78,6 +78,31 @@ const uint8_t SI4707_PATCH_DATA[PATCH_DATA_LENGTH * 8] =
   0x16, 0x10, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00,
   0x15, 0x00, 0x00, 0x00, 0x00, 0x00, 0xD1, 0x95
 };
+//
+//  SAME Event Codes, a SameRecord stores the index + 1.
+//
+#define SAME_EVENT_CODES                 62      //  Number of known Event Codes.
+//
+const char SAME_EVENT_CODE[SAME_EVENT_CODES][4] =
+{
+  "ADR", "AVA", "AVW", "BLU", "BZW", "CAE", "CDW", "CEM", "CFA", "CFW",
+  "DMO", "DSW", "EAN", "EAT", "EQW", "EVI", "EWW", "FFA", "FFS", "FFW",
+  "FLA", "FLS", "FLW", "FRW", "FSW", "FZW", "HLS", "HMW", "HUA", "HUW",
+  "HWA", "HWW", "LAE", "LEW", "NAT", "NIC", "NMN", "NPT", "NST", "NUW",
+  "RHW", "RMT", "RWT", "SMW", "SPS", "SPW", "SQW", "SSA", "SSW", "SVA",
+  "SVR", "SVS", "TOA", "TOE", "TOR", "TRA", "TRW", "TSA", "TSW", "VOW",
+  "WSA", "WSW"
+};
+//
+//  Properties read into a Diagnostics snapshot, in order.
+//
+const uint16_t DIAG_PROPERTY[DIAG_PROPERTIES] =
+{
+  GPO_IEN, REFCLK_FREQ, REFCLK_PRESCALE, RX_VOLUME, RX_HARD_MUTE, WB_MAX_TUNE_ERROR,
+  WB_RSQ_INT_SOURCE, WB_RSQ_SNR_HIGH_THRESHOLD, WB_RSQ_SNR_LOW_THRESHOLD,
+  WB_RSQ_RSSI_HIGH_THRESHOLD, WB_RSQ_RSSI_LOW_THRESHOLD, WB_VALID_SNR_THRESHOLD,
+  WB_VALID_RSSI_THRESHOLD, WB_SAME_INTERRUPT_SOURCE, WB_ASQ_INT_SOURCE
+};
 //  Global Status Bytes.
 //
 uint8_t intStatus =  0x00;
@@ -86,6 +111,7 @@ uint8_t sameStatus = 0x00;
 uint8_t asqStatus =  0x00;
 uint8_t agcStatus =  0x00;
 uint8_t msgStatus =  0x00;
+uint8_t statusRead = 0x00;                       //  STCINT, SAMEINT, ASQINT and ERRINT as tick() reads them.
 //
 //  Global Radio Variables.
 //
@@ -97,6 +123,18 @@ uint8_t rssi;
 uint8_t snr;
 int freqoff;
 uint8_t power = OFF;
+uint32_t resumeTime;
+uint32_t restoreTime;
+uint8_t rsqValid;
+uint32_t relockTime;
+uint32_t decodeTime;
+//
+//  Global I2C Health Counters.
+//
+uint16_t i2cErrors;
+uint16_t i2cRetries;
+uint16_t i2cRecoveries;
+uint16_t i2cMisses;                              //  Single attempts (tick(), CTS polls) the caller makes again.
 //
 //  Global SAME Variables.
 //
@@ -109,24 +147,221 @@ uint8_t sameState;
 uint8_t sameLength;
 uint8_t samePlusIndex;
 uint8_t sameLocations;
-uint32_t sameLocationCodes[SAME_LOCATION_CODES];
+uint32_t sameLocationCodes[SAME_LOCATION_CODES + 1];
 uint16_t sameDuration;
 uint16_t sameDay;
 uint16_t sameTime;
 uint8_t sameWat = 0x02;
-uint8_t response[15];
+uint8_t sameMessageState = SAME_IDLE;
+uint32_t sameTimer;
+uint32_t sameHash;
+//
+//
+//  The log must fit the storage where its size is known when compiling,
+//  elsewhere logRecover() sizes the log from EEPROM.length().
+//
+static_assert(NV_LOG_SIZE % LOG_FRAME_SIZE == 0 && LOG_SLOTS <= 255, "NV_LOG_SIZE must be a multiple of LOG_FRAME_SIZE, 255 frames at most.");
+static_assert(WB_CHANNELS * sizeof(ChannelRecord) + 2 == NV_CHANNEL_SIZE, "NV_CHANNEL_SIZE must hold the channel history and its CRC.");
+#if defined(EEPROM_SIZE)
+static_assert(NV_LOG_START + NV_LOG_SIZE <= EEPROM_SIZE, "The alert log does not fit in the EEPROM, lower NV_LOG_SIZE.");
+#endif
+//
+//  Default Non-Volatile Storage access.
+//
+static uint8_t nvEepromRead(uint16_t address)
+{
+  return EEPROM.read(address);
+}
 //
+static void nvEepromWrite(uint16_t address, uint8_t value)
+{
+  if (EEPROM.read(address) != value)            //  Don't wear cells that already hold the value.
+    EEPROM.write(address, value);
+}
 //
 //  Static Class Variables.
 //
-uint8_t SI4707::sameConf[8];
-char SI4707::sameData[8];
 uint8_t SI4707::rxConfidence[SAME_BUFFER_SIZE];
 char SI4707::rxBuffer[SAME_BUFFER_SIZE];  
 //
 uint8_t SI4707::rxBufferIndex;
 uint8_t SI4707::rxBufferLength;
 //
+SI4707::RuleEntry SI4707::ruleTable[RULE_MAX];
+uint16_t SI4707::ruleIndex[RULE_TRIGGERS];
+uint8_t SI4707::ruleCount;
+uint8_t SI4707::ruleAsq;
+uint8_t SI4707::eomHeard;
+uint8_t SI4707::headerCurrent;
+uint32_t SI4707::eomTimer;
+uint8_t SI4707::gpoLevel;
+//
+uint32_t SI4707::dedupHash[SAME_DEDUP_SIZE];
+uint32_t SI4707::dedupStamp[SAME_DEDUP_SIZE];
+uint32_t SI4707::dedupLife[SAME_DEDUP_SIZE];
+//
+SameRecord SI4707::historyRing[SAME_HISTORY_SIZE];
+uint8_t SI4707::historyHead;
+uint8_t SI4707::historyFill;
+//
+NvRead SI4707::nvRead = nvEepromRead;
+NvWrite SI4707::nvWrite = nvEepromWrite;
+uint16_t SI4707::nvSize;
+uint8_t SI4707::logQueue[LOG_QUEUE_SIZE][LOG_FRAME_SIZE];
+uint8_t SI4707::logQueueHead;
+uint8_t SI4707::logQueueFill;
+uint8_t SI4707::logHead;
+uint8_t SI4707::logFill;
+uint8_t SI4707::logSlots;
+uint16_t SI4707::logSequence;
+//
+uint16_t SI4707::rsqSources;
+uint16_t SI4707::rsqRssiAverage;
+uint16_t SI4707::rsqSnrAverage;
+uint8_t SI4707::rsqWindow = RSQ_WINDOW_MIN;
+uint8_t SI4707::rsqHold;
+uint8_t SI4707::rsqPending;
+uint32_t SI4707::rsqTimer;
+uint8_t SI4707::rsqThreshold[4];
+uint8_t SI4707::frontPolicy;
+uint8_t SI4707::frontState;
+uint8_t SI4707::frontBurst;
+uint8_t SI4707::frontRail;
+uint8_t SI4707::frontEvents;
+uint8_t SI4707::frontPoll;
+uint8_t SI4707::frontAgcQueued;                  //  Handle of an AGC override tick() has not sent yet.
+uint32_t SI4707::frontFrozen;
+uint32_t SI4707::frontTimer;
+uint32_t SI4707::frontPolled;
+uint32_t SI4707::frontRelocked;
+//
+uint16_t SI4707::propertyId[PROPERTY_CACHE];
+uint16_t SI4707::propertyValue[PROPERTY_CACHE];
+uint8_t SI4707::propertyCount;
+uint8_t SI4707::patched;
+//
+ChannelRecord SI4707::channelTable[WB_CHANNELS];
+uint8_t SI4707::channelDirty;
+uint8_t SI4707::channelVerify;
+uint32_t SI4707::channelTimer;
+//
+SI4707::QueueEntry SI4707::queue[QUEUE_SIZE];
+uint8_t SI4707::queueHandle;
+uint8_t SI4707::queueFill;
+uint8_t SI4707::queueSent;
+//
+SI4707::StepResponse SI4707::stepResponse;
+uint8_t SI4707::stepCommand;
+uint8_t SI4707::stepMode;
+uint8_t SI4707::stepAddress;
+uint8_t SI4707::stepChunk = STEP_NONE;
+uint8_t SI4707::stepWanted;
+uint8_t SI4707::stepDrop;
+uint32_t SI4707::stepTimer;
+//
+//  Packs a three character SAME code into a single word, NULL packs to 0.
+//
+static uint32_t samePack(const char *code)
+{
+  if (code == NULL)
+    return 0;
+  
+  return (uint32_t(uint8_t(code[0])) << 16 | uint32_t(uint8_t(code[1])) << 8 | uint8_t(code[2]));
+}
+//
+//  Returns 1 if a Header location code covers the wanted one.
+//  A leading 0 in the Header covers the whole county.
+//
+static uint8_t sameLocationMatch(uint32_t code, uint32_t wanted)
+{
+  return (code == wanted || (code < 100000UL && code == wanted % 100000UL));
+}
+//
+//  Appends text to a JSON buffer, returns 0 once it no longer fits.
+//
+static uint8_t jsonText(char *buffer, uint16_t size, uint16_t &length, const char *text)
+{
+  while (*text)
+    {
+      if (length + 1 >= size)
+        return 0;
+      
+      buffer[length++] = *text++;
+    }
+  
+  buffer[length] = 0x00;
+  return 1;
+}
+//
+//  Appends a decoded string to a JSON buffer.  Quotes, backslashes, control
+//  characters and bytes outside ASCII, a noisy decode, become \u00XX.
+//
+static uint8_t jsonString(char *buffer, uint16_t size, uint16_t &length, const char *text)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  char escaped[7] = { '\\', 'u', '0', '0', 0x00, 0x00, 0x00 };
+  char plain[2] = { 0x00, 0x00 };
+  uint8_t c, ok = 1;
+  
+  for (; *text && ok; text++)
+    {
+      c = *text;
+      
+      if (c < 0x20 || c > 0x7E || c == '"' || c == '\\')
+        {
+          escaped[4] = hex[c >> 4];
+          escaped[5] = hex[c & 0x0F];
+          ok = jsonText(buffer, size, length, escaped);
+        }
+      
+      else
+        {
+          plain[0] = c;
+          ok = jsonText(buffer, size, length, plain);
+        }
+    }
+  
+  return ok;
+}
+//
+//  Appends a decimal number to a JSON buffer.
+//
+static uint8_t jsonNumber(char *buffer, uint16_t size, uint16_t &length, int32_t value)
+{
+  char digits[12];
+  uint8_t i = sizeof(digits) - 1;
+  uint32_t magnitude = value < 0 ? -value : value;
+  
+  digits[i] = 0x00;
+  
+  do
+    {
+      digits[--i] = '0' + magnitude % 10;
+      magnitude /= 10;
+    }
+  while (magnitude);
+  
+  if (value < 0)
+    digits[--i] = '-';
+  
+  return jsonText(buffer, size, length, &digits[i]);
+}
+//
+//  Adds bytes to an FNV-1a hash.
+//
+static uint32_t sameHashAdd(uint32_t hash, const void *data, uint8_t length)
+{
+  const uint8_t *p = (const uint8_t *) data;
+  
+  while (length--)
+    {
+      hash ^= *p++;
+      hash *= 16777619UL;
+    }
+  
+  return hash;
+}
+//
 // Begin using the Si4707.
 //
 void SI4707::begin(void)
@@ -140,86 +375,93 @@ void SI4707::begin(void)
   //digitalWrite(INT, HIGH);
 }  
 //
-//  Powers up the Si4707.
+//  Powers up the Si4707.  Returns 0, leaving power OFF, if it did not take the command.
 //  
-void SI4707::on(void)
+uint8_t SI4707::on(void)
 {
   if (power)
-    return;
+    return 1;
+  
+  uint8_t args[3] = { POWER_UP, GPO2EN | XOSCEN | WB, OPMODE };
+  uint8_t status;
   
-  Wire.beginTransmission(RADIO_ADDRESS);
-  Wire.write(POWER_UP);
-  Wire.write(GPO2EN | XOSCEN | WB);
-  Wire.write(OPMODE);
-  Wire.endTransmission();
+  if (!i2cWrite(args, sizeof(args)))
+    return 0;
 
   delay(PUP_DELAY);  
     
-  readStatus();
+  if (!readStatus(status) || status & ERRINT)
+    return 0;
    
   power = ON;  
+  return 1;
 }    
 //
-//  Gets the revision of the Si4707.
-//
-void SI4707::getRevision(void)
-{
-  writeCommand(GET_REV);
-  readBurst(9);
-  delay(10);
-  char partNumber[] = "Si470";
-  int pN = int(response[1]);
-  Serial.print(F("Part Number: "));
-  Serial.print(partNumber);
-  Serial.println(pN);
-  Serial.print(F("Major Firmware Revision: 0x"));
-  Serial.println(response[2], HEX);
-  Serial.print(F("Minor Firmware Revision: 0x"));
-  Serial.println(response[3], HEX);
-  uint16_t pID = (response[4] << 8 | response[5]);
-  Serial.print(F("Patch ID: 0x"));
-  Serial.println(pID, HEX);
-  Serial.print(F("Component Firmware Major Revision: 0x"));
-  Serial.println(response[6], HEX);
-  Serial.print(F("Component Firmware Minor Revision: 0x"));
-  Serial.println(response[7], HEX);
-  Serial.print("Chip Revision: 0x");
-  Serial.println(response[8], HEX);
-  Serial.println(F(""));
-} 
-//
-//  Powers up the Si4707 and uploads a patch.
-//
-void SI4707::patch(void)
+//  Reads the revision of the Si4707 into revision, returns 0 if it could not be read.
+//
+uint8_t SI4707::getRevision(Revision &revision)
+{
+  uint8_t command = GET_REV;
+  Response<9> r;
+  
+  if (!query(&command, 1, r.raw, sizeof(r.raw)))
+    return 0;
+  
+  revision.partNumber = r[1];
+  revision.firmwareMajor = r[2];
+  revision.firmwareMinor = r[3];
+  revision.patchId = r.word(4);
+  revision.componentMajor = r[6];
+  revision.componentMinor = r[7];
+  revision.chipRevision = r[8];
+  
+  return 1;
+}
+//
+//  Powers up the Si4707 and uploads a patch.  Returns 0, leaving power OFF
+//  and the Si4707 powered down again, if any of it was not taken.
+//
+uint8_t SI4707::patch(void)
 {
   if (power)
-    return;
+    return 1;
   
-  uint16_t i, j;
+  uint16_t i;
+  uint8_t args[3] = { POWER_UP, GPO2EN | PATCH | XOSCEN | WB, OPMODE };
+  uint8_t command = POWER_DOWN;
+  uint8_t status;
       
-  Wire.beginTransmission(RADIO_ADDRESS);
-  Wire.write(POWER_UP);
-  Wire.write(GPO2EN | PATCH | XOSCEN | WB);
-  Wire.write(OPMODE);
-  Wire.endTransmission();
+  if (!i2cWrite(args, sizeof(args)))
+    return 0;
 
   delay(PUP_DELAY);
   
-  readStatus();
+  if (!readStatus(status) || status & ERRINT)
+    {
+      i2cWrite(&command, 1);
+      return 0;
+    }
 
   for (i = 0; i < sizeof(SI4707_PATCH_DATA); i += 8)
     {
-      Wire.beginTransmission(RADIO_ADDRESS);
-      
-      for (j = 0; j < 8; j++)
-        Wire.write(SI4707_PATCH_DATA[i + j]);
+      if (!i2cWrite(&SI4707_PATCH_DATA[i], 8))
+        break;
       
-      Wire.endTransmission();
       delay(PROP_DELAY);
-      readStatus();
+      
+      if (!readStatus(status) || status & ERRINT)
+        break;
+    }
+  
+  if (i < sizeof(SI4707_PATCH_DATA))             //  Half a patch, start over from a power down.
+    {
+      i2cWrite(&command, 1);
+      return 0;
     }
   
   power = ON;    
+  patched = ON;
+  return 1;
 }
 //
 //  Powers down the Si4707.
@@ -234,6 +476,125 @@ void SI4707::off()
   delay(CMD_DELAY);
 }
 //
+//  Puts the Si4707 in Standby, keeping it powered, patched and tuned,
+//  but muted and only interrupting for SAME and the Alert Tone.
+//
+void SI4707::standby(void)
+{
+  if (power != ON)
+    return;
+  
+  writeProperty(RX_HARD_MUTE, 0x0003);
+  writeProperty(GPO_IEN, propertyCached(GPO_IEN, STANDBY_IEN) & STANDBY_IEN);
+  power = STANDBY;
+}
+//
+//  Resumes from Standby in two transactions, the time taken is left in resumeTime (usec).
+//
+void SI4707::resume(void)
+{
+  uint32_t start = micros();
+  
+  if (power != STANDBY)
+    return;
+  
+  writeProperty(GPO_IEN, propertyCached(GPO_IEN, STANDBY_IEN));
+  writeProperty(RX_HARD_MUTE, propertyCached(RX_HARD_MUTE, mute ? 0x0003 : 0x0000));
+  power = ON;
+  intStatus |= INTAVL;                           //  Catch up on anything that was not interrupting.
+  
+  resumeTime = micros() - start;
+}
+//
+//  Powers up after off(), reapplying the patch, every property set so far
+//  and the channel.  The time taken is left in restoreTime (usec).
+//  power stays OFF if the Si4707 did not power up.
+//
+void SI4707::restore(void)
+{
+  uint32_t start = micros();
+  
+  if (power == STANDBY)
+    {
+      resume();
+      return;
+    }
+  
+  if (power)
+    return;
+  
+  if (!(patched ? patch() : on()))
+    return;
+  
+  for (uint8_t i = 0; i < propertyCount; i++)
+    writeProperty(propertyId[i], propertyValue[i]);
+  
+  tune();
+  
+  restoreTime = micros() - start;
+}
+//
+//  Plays a RADIO_PROFILE() script.  Properties are sent back to back,
+//  each waiting only for CTS rather than PROP_DELAY.  Returns 0 if the
+//  script has an unknown opcode, or the Si4707 did not power up.
+//
+uint8_t SI4707::execute(const uint8_t *script)
+{
+  uint8_t args[6] = { SET_PROPERTY, 0x00 };
+  uint16_t property, value;
+  
+  for (;;)
+    {
+      switch (script[0])
+        {
+          case SCRIPT_END:
+                    return 1;
+          
+          case SCRIPT_POWER:
+                    if (!(script[1] ? patch() : on()))
+                      return 0;
+                    script += 2;
+                    break;
+          
+          case SCRIPT_PROPERTY:
+                    property = script[1] << 8 | script[2];
+                    value = script[3] << 8 | script[4];
+                    script += 5;
+                    
+                    if (property == RX_VOLUME)
+                      volume = value;
+                    
+                    if (!propertyRemember(property, value))
+                      break;
+                    
+                    args[2] = highByte(property);
+                    args[3] = lowByte(property);
+                    args[4] = highByte(value);
+                    args[5] = lowByte(value);
+                    
+                    waitClear();
+                    
+                    if (i2cWrite(args, sizeof(args)))
+                      queueSent = 1;             //  The next one waits for CTS.
+                    break;
+          
+          case SCRIPT_TUNE:
+                    value = script[1] << 8 | script[2];
+                    script += 3;
+                    
+                    if (value)
+                      {
+                        channel = value;
+                        tune();
+                      }
+                    break;
+          
+          default:
+                    return 0;
+        }
+    }
+}
+//
 //  End using the Si4707.
 //
 void SI4707::end(void)
@@ -261,6 +622,7 @@ void SI4707::tune(void)
 {
   writeWord(WB_TUNE_FREQ, channel);
   delay(TUNE_DELAY);
+  sameFlush();                                   //  Anything in the buffers belongs to the old channel.
   intStatus |= INTAVL;
 }
 //
@@ -269,16 +631,20 @@ void SI4707::tune(void)
 void SI4707::scan(void)
 {
   uint16_t i;
-  uint16_t best_channel;
+  uint16_t best_channel = WB_MIN_FREQUENCY;
   uint8_t  best_rssi = 0x00;
   
-  setMute(ON);
+  writeProperty(RX_HARD_MUTE, 0x0003);          //  Inline, the scan itself does not wait for tick().
   
   for (i = WB_MIN_FREQUENCY; i <= WB_MAX_FREQUENCY; i += WB_CHANNEL_SPACING)
     {
       channel = i;
       tune();
       getTuneStatus(INTACK);
+      
+      channelRecord().rssi = rssi;
+      channelRecord().snr = snr;
+      channelDirty = 1;
     
       if (rssi > best_rssi)
         {    
@@ -289,369 +655,1947 @@ void SI4707::scan(void)
   
   channel = best_channel;
   tune();
-  setMute(OFF);
+  writeProperty(RX_HARD_MUTE, propertyCached(RX_HARD_MUTE, mute ? 0x0003 : 0x0000));
   intStatus |= INTAVL;
 }
 //
-//  Returns the current Interrupt Status.
+//  Tunes straight to the channel with the best stored history, leaving
+//  channelService() to verify it.  Scans if there is no usable history.
+//  Returns 1 if the stored history was used.
 //
-uint8_t SI4707::getIntStatus(void)
+uint8_t SI4707::tuneBest(void)
 {
-  writeCommand(GET_INT_STATUS);
-  readStatus();
-  intStatus = response[0];
+  uint8_t i, best = WB_CHANNELS;
   
-  return intStatus;
-}	 
+  channelVerify = 0;
+  
+  if (channelLoad())
+    {
+      for (i = 0; i < WB_CHANNELS; i++)
+        {
+          ChannelRecord &record = channelTable[i];
+          
+          if (record.rssi < CHANNEL_MIN_RSSI || record.snr < CHANNEL_MIN_SNR)
+            continue;
+          
+          if (best == WB_CHANNELS ||                       //  Prefer the most recent SAME, then the strongest.
+              record.sameTime > channelTable[best].sameTime ||
+              (record.sameTime == channelTable[best].sameTime && record.rssi > channelTable[best].rssi))
+            best = i;
+        }
+    }
+  
+  if (best == WB_CHANNELS)
+    {
+      scan();
+      return 0;
+    }
+  
+  channel = WB_MIN_FREQUENCY + best * WB_CHANNEL_SPACING;
+  tune();
+  
+  channelVerify = 1;
+  channelTimer = millis();
+  
+  return 1;
+}
 //
-//  Gets the current Tune Status.
+//  Verifies a channel chosen by tuneBest(), scanning only if it fails.  Call from loop().
+//  channelVerify is 1 while it waits, 2 while tick() reads the RSQ Status.
 //
-void SI4707::getTuneStatus(uint8_t mode)
+void SI4707::channelService(void)
 {
-  writeByte(WB_TUNE_STATUS, mode);
+  if (channelVerify == 1 && millis() - channelTimer >= CHANNEL_VERIFY_TIME)
+    {
+      channelVerify = (sameMessageState == SAME_IDLE) ? 2 : 0;  //  Already hearing SAME, no need to look.
+      stepWanted |= (channelVerify ? STEP_RSQ_CHECK : 0);
+      return;
+    }
+  
+  if (channelVerify != 2 || stepWanted & STEP_RSQ_CHECK)
+    return;
   
-  readBurst(6);
+  channelVerify = 0;
   
-  channel = (0x0000 | response[2] << 8 | response[3]);
-  frequency = channel * .0025;
-  rssi = response[4];
-  snr = response[5];
+  if (rssi < CHANNEL_MIN_RSSI || snr < CHANNEL_MIN_SNR)
+    scan();                                      //  A scan tunes every channel, it still runs inline.
 }
 //
-//  Gets the current RSQ Status.
-//  
-void SI4707::getRsqStatus(uint8_t mode)
+//  Returns the history of the current channel.
+//
+ChannelRecord &SI4707::channelRecord(void)
 {
-  writeByte(WB_RSQ_STATUS, mode);
-  
-  readBurst(8);
+  uint8_t i = (channel - WB_MIN_FREQUENCY) / WB_CHANNEL_SPACING;
   
-  rsqStatus = response[1];
-  rssi = response[4];
-  snr = response[5];
-  freqoff = response[7];
-  
-  if (freqoff >= 128)
-    freqoff = (freqoff - 256) >> 1;
-  else
-    freqoff = (freqoff >> 1);
+  return channelTable[i < WB_CHANNELS ? i : WB_CHANNELS - 1];
 }
 //
-//  Gets the current SAME Status.
+//  Stamps the current channel with the time of a SAME Header.  The history is
+//  only stored when this changes which channel heard SAME last, the order
+//  tuneBest() ranks them in, not after every Header.
 //
-void SI4707::getSameStatus(uint8_t mode)
+void SI4707::channelSame(void)
 {
-  uint8_t i, j;
+  ChannelRecord &record = channelRecord();
+  uint8_t i;
   
-  writeAddress(0x00, mode);
-
-  readBurst(4); 
+  for (i = 0; i < WB_CHANNELS; i++)
+    if (&channelTable[i] != &record && channelTable[i].sameTime >= record.sameTime)
+      channelDirty = 1;
   
-  sameStatus = response[1];
-  sameState  = response[2];
-  sameLength = response[3];
-      
-  if (!(sameStatus & HDRRDY))                    //  If no HDRRDY, return.
-    return;
-    
-  //TIMER1_START();                                //  Start/Re-start the 6 second timer.
+  record.sameTime = Time.now();
+}
+//
+//  Loads the channel history, returns 0 and clears it if it is not valid.
+//
+uint8_t SI4707::channelLoad(void)
+{
+  uint8_t *data = (uint8_t *) channelTable;
+  uint16_t crc;
+  uint8_t i;
   
-  sameHeaderCount++;
-      
-  if (sameHeaderCount >= 3)                      //  If this is the third Header, set msgStatus to show that it needs to be purged after usage.
-    msgStatus |= MSGPUR;
+  memset(channelTable, 0, sizeof(channelTable));
   
-  if (sameLength < SAME_MIN_LENGTH)              //  Don't process messages that are too short to be valid.
-    return;
+  if (nvLength() < NV_CHANNEL_START + NV_CHANNEL_SIZE)
+    return 0;
   
-  for (i = 0; i < sameLength && i < SAME_BUFFER_SIZE; i += 8)  
-    {
-      writeAddress(i, CHECK);
-      
-      readBurst(14);
-    
-      sameConf[0] = (response[5] & SAME_STATUS_OUT_CONF0) >> SAME_STATUS_OUT_CONF0_SHFT;
-      sameConf[1] = (response[5] & SAME_STATUS_OUT_CONF1) >> SAME_STATUS_OUT_CONF1_SHFT;
-      sameConf[2] = (response[5] & SAME_STATUS_OUT_CONF2) >> SAME_STATUS_OUT_CONF2_SHFT;
-      sameConf[3] = (response[5] & SAME_STATUS_OUT_CONF3) >> SAME_STATUS_OUT_CONF3_SHFT;
-      sameConf[4] = (response[4] & SAME_STATUS_OUT_CONF4) >> SAME_STATUS_OUT_CONF4_SHFT;
-      sameConf[5] = (response[4] & SAME_STATUS_OUT_CONF5) >> SAME_STATUS_OUT_CONF5_SHFT;
-      sameConf[6] = (response[4] & SAME_STATUS_OUT_CONF6) >> SAME_STATUS_OUT_CONF6_SHFT;
-      sameConf[7] = (response[4] & SAME_STATUS_OUT_CONF7) >> SAME_STATUS_OUT_CONF7_SHFT;
-
-      sameData[0] = response[6];
-      sameData[1] = response[7];
-      sameData[2] = response[8];
-      sameData[3] = response[9];
-      sameData[4] = response[10];
-      sameData[5] = response[11];
-      sameData[6] = response[12];
-      sameData[7] = response[13];
-      
-      for (j = 0; j + i < sameLength && j < 8; j++)
-        {
-          rxBuffer[j + i] = sameData[j];
-          rxConfidence[j + i] = sameConf[j];
-          if (rxBuffer[j + i] < 0x2B  || rxBuffer[j + i] > 0x7F)
-            {
-              sameLength = j + i;
-              break;
-            }
-        }
-    }
+  for (i = 0; i < sizeof(channelTable); i++)
+    data[i] = nvRead(NV_CHANNEL_START + i);
   
-  msgStatus |= MSGAVL;
+  crc = nvRead(NV_CHANNEL_START + i) << 8 | nvRead(NV_CHANNEL_START + i + 1);
   
-  for (i = 0; i < sameLength; i++)
-    {
-      if (rxConfidence[i] > SAME_CONFIDENCE_THRESHOLD)
-        rxConfidence[i] = SAME_CONFIDENCE_THRESHOLD;
-                       
-      if (rxConfidence[i] < SAME_CONFIDENCE_THRESHOLD)
-        {
-          msgStatus &= ~MSGAVL;
-          break;
-        }  
-    }
-
-  if (!(msgStatus & MSGAVL))
-    return;
+  if (crc == crc16(data, sizeof(channelTable)))
+    return 1;
   
-  rxBufferIndex = 0;
-  rxBufferLength = sameLength;
+  memset(channelTable, 0, sizeof(channelTable));
+  return 0;
 }
 //
-//  Gets the current ASQ Status.
+//  Stores the channel history, only changed bytes are written.
 //
-void SI4707::getAsqStatus(uint8_t mode)
+void SI4707::channelSave(void)
 {
-  writeByte(WB_ASQ_STATUS, mode);
+  uint8_t *data = (uint8_t *) channelTable;
+  uint16_t crc = crc16(data, sizeof(channelTable));
+  uint8_t i;
+  
+  channelDirty = 0;
+  
+  if (nvLength() < NV_CHANNEL_START + NV_CHANNEL_SIZE)
+    return;
   
-  readBurst(3);
+  for (i = 0; i < sizeof(channelTable); i++)
+    nvWrite(NV_CHANNEL_START + i, data[i]);
   
-  asqStatus = response[1];
+  nvWrite(NV_CHANNEL_START + i, highByte(crc));
+  nvWrite(NV_CHANNEL_START + i + 1, lowByte(crc));
 }
 //
-//  Gets the current AGC Status.
+//  Returns the current Interrupt Status.
 //
-void SI4707::getAgcStatus(void)
+uint8_t SI4707::getIntStatus(void)
 {
-  writeCommand(WB_AGC_STATUS);
+  uint8_t status;
   
-  readBurst(2);
+  intStatus &= ~INTAVL;                          //  Taken now, an interrupt from here on sets it again.
+  writeCommand(GET_INT_STATUS);
   
-  agcStatus = response[1];
-}
+  if (readStatus(status))
+    intStatus = status | (intStatus & INTAVL);
+  
+  return intStatus;
+}	 
 //
-//  Sets the audio volume level.
+//  Gets the current Tune Status.
 //
-void SI4707::setVolume(uint16_t volume)
+void SI4707::getTuneStatus(uint8_t mode)
 {
-  if (volume < 0x0000 || volume > 0x003F)
-    return;
-     
-  setProperty(RX_VOLUME, volume);
+  TuneStatus status;
+  
+  if (getTuneStatus(mode, status))
+    statusApply(status);
 }
 //
-//  Sets the current Mute state.
+//  Reads the current Tune Status into status, returns 0 if it could not be read.
 //
-void SI4707::setMute(uint8_t value)
+uint8_t SI4707::getTuneStatus(uint8_t mode, TuneStatus &status)
 {
-  switch (value)
-    {
-      case OFF:
-                setProperty(RX_HARD_MUTE, 0x0000);
-                mute = OFF;
-                break;
-
-      case ON:
-                setProperty(RX_HARD_MUTE, 0x0003);
-                mute = ON;
-                break;
-        
-      default:
-                break;      
-    }
+  Response<6> r;
+  
+  writeByte(WB_TUNE_STATUS, mode);
+  
+  if (!readResponse(r))
+    return 0;
+  
+  statusDecode(r, status);
+  return 1;
 }
 //
-//  Sets a specified property value.
+//  Decodes a Tune Status response.
 //
-void SI4707::setProperty(uint16_t property, uint16_t value)
+void SI4707::statusDecode(const Response<6> &r, TuneStatus &status)
 {
-  Wire.beginTransmission(RADIO_ADDRESS);
-  Wire.write(SET_PROPERTY);
-  Wire.write(uint8_t(0x00));
-  Wire.write(highByte(property));
-  Wire.write(lowByte(property));
-  Wire.write(highByte(value));
-  Wire.write(lowByte(value));
-  Wire.endTransmission();
-  delay(PROP_DELAY);
+  status.status = r[0];
+  status.valid = r[1];
+  status.channel = r.word(2);
+  status.rssi = r[4];
+  status.snr = r[5];
 }
 //
-//  Returns a specified property value.
+//  Takes a Tune Status into the globals.
 //
-uint16_t SI4707::getProperty(uint16_t property)
+void SI4707::statusApply(const TuneStatus &status)
 {
-  uint16_t value = 0;
-  
-  writeWord(GET_PROPERTY, property);
-  
-  readBurst(3);
+  channel = status.channel;
+  frequency = channel * .0025;
+  rssi = status.rssi;
+  snr = status.snr;
+}
+//
+//  Gets the current RSQ Status.
+//  
+void SI4707::getRsqStatus(uint8_t mode)
+{
+  RsqStatus status;
+  
+  if (getRsqStatus(mode, status))
+    statusApply(status);
+}
+//
+//  Reads the current RSQ Status into status, returns 0 if it could not be read.
+//
+uint8_t SI4707::getRsqStatus(uint8_t mode, RsqStatus &status)
+{
+  Response<8> r;
+  
+  writeByte(WB_RSQ_STATUS, mode);
+  
+  if (!readResponse(r))
+    return 0;
+  
+  statusDecode(r, status);
+  return 1;
+}
+//
+//  Decodes an RSQ Status response.
+//
+void SI4707::statusDecode(const Response<8> &r, RsqStatus &status)
+{
+  status.status = r[0];
+  status.interrupts = r[1];
+  status.valid = r[2];
+  status.rssi = r[4];
+  status.snr = r[5];
+  status.freqoff = int8_t(r[7]) >> 1;
+}
+//
+//  Takes an RSQ Status into the globals and the channel history.
+//
+void SI4707::statusApply(const RsqStatus &status)
+{
+  rsqStatus = status.interrupts;
+  rsqValid = status.valid;
+  rssi = status.rssi;
+  snr = status.snr;
+  freqoff = status.freqoff;
+  
+  channelRecord().rssi = rssi;                   //  Kept in RAM, stored with the next history write.
+  channelRecord().snr = snr;
+  channelRecord().freqoff = freqoff;
+}
+//
+//  Starts adaptive RSQ thresholds for the given WB_RSQ_INT_SOURCE sources.
+//  The thresholds follow a hysteresis window around the recent RSSI and SNR.
+//
+void SI4707::rsqBegin(uint16_t sources)
+{
+  rsqSources = sources;
+  rsqWindow = RSQ_WINDOW_MIN;
+  rsqHold = 0;
+  rsqTimer = millis() - RSQ_MIN_INTERVAL;
+  
+  for (uint8_t i = 0; i < 4; i++)
+    rsqThreshold[i] = 0xFF;                      //  Force every threshold to be written.
+  
+  getRsqStatus(CHECK);
+  
+  rsqRssiAverage = rssi << 4;
+  rsqSnrAverage = snr << 4;
+  
+  rsqThresholds();
+  setProperty(WB_RSQ_INT_SOURCE, rsqSources);
+}
+//
+//  Services a pending RSQ interrupt at a bounded rate, call from loop().
+//  Returns the RSSI/SNR high/low bits that fired, 0 if there was nothing to report.
+//
+uint8_t SI4707::rsqService(void)
+{
+  uint32_t now = millis();
+  
+  if (rsqHold && now - rsqTimer >= RSQ_HOLD_OFF)
+    {
+      rsqHold = !queueProperty(WB_RSQ_INT_SOURCE, rsqSources, QUEUE_NORMAL);  //  Queued until sent, or try again.
+    }
+  
+  if (!rsqPending)                               //  tick() reads the RSQ Status an RSQ interrupt asks for.
+    return 0;
+  
+  rsqPending = 0;
+  
+  if (now - rsqTimer < RSQ_MIN_INTERVAL)         //  Too soon, widen the window or hold off.
+    {
+      if (rsqWindow < RSQ_WINDOW_MAX)
+        rsqWindow += RSQ_WINDOW_MIN;
+      
+      else if (!rsqHold)                         //  Already held, don't queue the mask again.
+        {
+          uint8_t args[6] = { SET_PROPERTY, 0x00, highByte(WB_RSQ_INT_SOURCE), lowByte(WB_RSQ_INT_SOURCE), 0x00, 0x00 };
+          
+          rsqHold = queueCommand(args, sizeof(args), QUEUE_NORMAL) != 0;  //  Not cached, restore() brings back the sources.
+        }
+    }
+  
+  else if (rsqWindow > RSQ_WINDOW_MIN)
+    rsqWindow--;
+  
+  rsqTimer = now;
+  
+  rsqRssiAverage += (int16_t((rssi << 4) - rsqRssiAverage)) >> 2;  //  Average over about four samples.
+  rsqSnrAverage += (int16_t((snr << 4) - rsqSnrAverage)) >> 2;
+  
+  rsqThresholds();
+  
+  return rsqStatus & (RSSILINT | RSSIHINT | SNRLINT | SNRHINT);
+}
+//
+//  Centers the RSQ thresholds on the averages, queuing only those that changed.
+//  A threshold the full queue refused is queued again next time.
+//
+void SI4707::rsqThresholds(void)
+{
+  static const uint16_t property[4] = { WB_RSQ_SNR_HIGH_THRESHOLD, WB_RSQ_SNR_LOW_THRESHOLD,
+                                        WB_RSQ_RSSI_HIGH_THRESHOLD, WB_RSQ_RSSI_LOW_THRESHOLD };
+  int16_t snrCenter = (rsqSnrAverage + 8) >> 4;
+  int16_t rssiCenter = (rsqRssiAverage + 8) >> 4;
+  int16_t value[4];
+  uint8_t i;
+  
+  value[0] = snrCenter + rsqWindow;
+  value[1] = snrCenter - rsqWindow;
+  value[2] = rssiCenter + rsqWindow;
+  value[3] = rssiCenter - rsqWindow;
+  
+  for (i = 0; i < 4; i++)
+    {
+      value[i] = constrain(value[i], 0, 127);
+      
+      if (value[i] == rsqThreshold[i])
+        continue;
+      
+      if (queueProperty(property[i], value[i], QUEUE_LOW))
+        rsqThreshold[i] = value[i];
+    }
+}
+//
+//  Holds the AGC gain where it is (ON), or hands it back to the Si4707 (OFF).
+//  agcStatus only follows if the command was sent.
+//
+void SI4707::setAgcOverride(uint8_t value)
+{
+  uint8_t args[2] = { WB_AGC_OVERRIDE, uint8_t(value ? AGCDIS : 0x00) };
+  
+  waitClear();
+  
+  if (i2cWrite(args, sizeof(args)))
+    agcStatus = args[1];
+  
+  delay(CMD_DELAY);
+}
+//
+//  Sets how far from the channel (kHz) the AFC may pull before it rails.
+//
+void SI4707::setMaxTuneError(uint16_t value)
+{
+  setProperty(WB_MAX_TUNE_ERROR, value);
+}
+//
+//  Starts front end control.  policy is FRONT_AGC_FREEZE and/or FRONT_AFC_RETUNE,
+//  maxTuneError the AFC limit (kHz).  relockTime and decodeTime are measured either way.
+//
+void SI4707::frontBegin(uint8_t policy, uint16_t maxTuneError)
+{
+  frontPolicy = policy;
+  frontState = FRONT_LOCKED;
+  frontBurst = frontRail = frontPoll = frontEvents = 0;
+  frontPolled = millis();
+  
+  setMaxTuneError(maxTuneError);
+  
+  if (agcStatus & AGCDIS)
+    setAgcOverride(OFF);
+  
+  getRsqStatus(CHECK);
+}
+//
+//  Applies the front end policy and polls the RSQ while the signal is lost or
+//  railed.  Call from loop() after rsqService().  Returns FRONT_RELOCKED and
+//  FRONT_DECODED as they are measured, or 0.
+//
+uint8_t SI4707::frontService(void)
+{
+  uint32_t now = millis();
+  uint8_t events = frontEvents;
+  uint8_t burst;
+  
+  frontEvents = 0;
+  
+  if (!power)
+    {
+      agcStatus &= ~AGCDIS;                      //  POWER_UP hands the AGC back.
+      frontState = FRONT_LOCKED;
+      frontBurst = frontRail = frontPoll = 0;
+      return events;
+    }
+  
+  burst = (sameMessageState == SAME_PREAMBLE || sameMessageState == SAME_HEADER);
+  
+  if (frontAgcQueued && queueDone(frontAgcQueued))
+    frontAgcQueued = 0;
+  
+  if (frontPolicy & FRONT_AGC_FREEZE && !frontAgcQueued)  //  agcStatus is not current until it is sent.
+    {
+      if (burst && !frontBurst && rsqValid & VALID && !(agcStatus & AGCDIS))
+        {
+          frontAgc(ON);
+          frontFrozen = now;
+        }
+      
+      else if (agcStatus & AGCDIS && (!burst || !(rsqValid & VALID) || now - frontFrozen >= FRONT_FREEZE_MAX))
+        frontAgc(OFF);
+    }
+  
+  frontBurst = burst;
+  
+  if (frontState != FRONT_LOST && !(rsqValid & VALID))
+    {
+      frontState = FRONT_LOST;
+      frontTimer = now;
+      frontRail = 0;
+    }
+  
+  if (frontState == FRONT_WAITING && now - frontRelocked >= FRONT_DECODE_WINDOW)
+    frontState = FRONT_LOCKED;                   //  No Header came, nothing to measure.
+  
+  if (frontPoll && !(stepWanted & STEP_RSQ_CHECK))  //  tick() has read the poll.
+    {
+      frontPoll = 0;
+      frontRail = (rsqValid & AFCRL) ? frontRail + 1 : 0;
+      
+      if (frontPolicy & FRONT_AFC_RETUNE && frontRail >= FRONT_RAIL_COUNT && sameMessageState == SAME_IDLE)
+        {
+          uint8_t args[4] = { WB_TUNE_FREQ, 0x00, highByte(channel), lowByte(channel) };
+          
+          if (queueCommand(args, sizeof(args), QUEUE_HIGH))  //  The AFC starts again from the channel.
+            {
+              frontRail = 0;
+              sameFlush();                       //  Anything in the buffers belongs to before the retune.
+            }
+        }
+    }
+  
+  if (!frontPoll && (frontState == FRONT_LOST || rsqValid & AFCRL || rsqHold) && now - frontPolled >= FRONT_POLL)
+    {
+      frontPolled = now;
+      frontPoll = 1;
+      stepWanted |= STEP_RSQ_CHECK;
+    }
+  
+  if (frontState == FRONT_LOST && rsqValid & VALID && !(rsqValid & AFCRL))
+    {
+      relockTime = millis() - frontTimer;
+      frontRelocked = millis();
+      frontState = FRONT_WAITING;
+      events |= FRONT_RELOCKED;
+    }
+  
+  return events;
+}
+//
+//  Queues an AGC override for tick(), agcStatus follows once it is sent.
+//
+void SI4707::frontAgc(uint8_t value)
+{
+  uint8_t args[2] = { WB_AGC_OVERRIDE, uint8_t(value ? AGCDIS : 0x00) };
+  
+  frontAgcQueued = queueCommand(args, sizeof(args), QUEUE_HIGH);
+}
+//
+//  Called by sameParse() with a clean Header, completes decodeTime after a relock.
+//
+void SI4707::frontDecoded(void)
+{
+  if (frontState != FRONT_WAITING)
+    return;
+  
+  decodeTime = millis() - frontTimer;
+  frontState = FRONT_LOCKED;
+  frontEvents |= FRONT_DECODED;
+}
+//
+//  Gets the current SAME Status.
+//
+void SI4707::getSameStatus(uint8_t mode)
+{
+  Response<4> r;
+  uint8_t i;
+  
+  writeAddress(0x00, mode);
+
+  if (!readResponse(r) || !sameUpdate(r, mode))
+    return;
+  
+  for (i = 0; i < sameLength && i < SAME_BUFFER_SIZE; i += 8)  
+    if (!readSameChunk(i))                       //  Don't pass off stale data as SAME text.
+      return;
+  
+  sameCheck();
+}
+//
+//  Takes a SAME Status response into the SAME message state.
+//  Returns 1 if the buffer holds a Header to be read.
+//
+uint8_t SI4707::sameUpdate(const Response<4> &r, uint8_t mode)
+{
+  sameStatus = r[1];
+  sameState  = r[2];
+  sameLength = r[3];
+  
+  if (sameStatus & EOMDET)                       //  End Of Message, sameService() will flush.
+    {
+      if (!eomHeard || millis() - eomTimer >= SAME_TIME_OUT * 1000UL)  //  One rule for the three EOMs.
+        ruleEvaluate(RULE_EOM);
+      
+      headerCurrent = 0;                         //  The message is over.
+      eomHeard = 1;
+      eomTimer = millis();                       //  Start/Re-start the 6 second timer.
+      sameMessageState = SAME_EOM;
+      return 0;
+    }
+  
+  if (mode & CLRBUF)                             //  Flushed, there is nothing left to take.
+    return 0;
+  
+  if (sameStatus & (PREDET | SOMDET) && sameMessageState == SAME_IDLE)
+    {
+      sameMessageState = SAME_PREAMBLE;
+      sameTimer = millis();                      //  Start the 6 second timer.
+    }
+      
+  if (!(sameStatus & HDRRDY))                    //  If no HDRRDY, return.
+    return 0;
+    
+  sameTimer = millis();                          //  Start/Re-start the 6 second timer.
+  
+  if (!sameHeaderCount)                          //  A new message, until it parses the last Header is not its own.
+    headerCurrent = 0;
+  
+  sameHeaderCount++;
+  sameMessageState = SAME_HEADER;
+      
+  if (sameHeaderCount >= 3)                      //  If this is the third Header, set msgStatus to show that it needs to be purged after usage.
+    {
+      msgStatus |= MSGPUR;
+      sameMessageState = SAME_COMPLETE;
+    }
+  
+  return sameLength >= SAME_MIN_LENGTH;          //  Don't process messages that are too short to be valid.
+}
+//
+//  Checks the confidence of the Header read into rxBuffer, making it available
+//  and parsing it right away when rules are loaded.
+//
+void SI4707::sameCheck(void)
+{
+  uint8_t i;
+  
+  msgStatus |= MSGAVL;
+  
+  for (i = 0; i < sameLength; i++)
+    {
+      if (rxConfidence[i] > SAME_CONFIDENCE_THRESHOLD)
+        rxConfidence[i] = SAME_CONFIDENCE_THRESHOLD;
+                       
+      if (rxConfidence[i] < SAME_CONFIDENCE_THRESHOLD)
+        {
+          msgStatus &= ~MSGAVL;
+          break;
+        }  
+    }
+
+  if (!(msgStatus & MSGAVL))
+    return;
+  
+  rxBufferIndex = 0;
+  rxBufferLength = sameLength;
+  
+  if (ruleCount && !(msgStatus & MSGUSD))       //  Parse right away, so the Header rules act now.
+    sameParse();
+}
+//
+//  Reads the eight SAME bytes at address straight into rxBuffer and rxConfidence,
+//  shortening sameLength at the first byte that can't be SAME text.
+//  Returns 0 if they could not be read.
+//
+uint8_t SI4707::readSameChunk(uint8_t address)
+{
+  SameChunk chunk;
+  
+  writeAddress(address, CHECK);
+  
+  if (!readResponse(chunk))
+    return 0;
+  
+  sameChunk(chunk, address);
+  return 1;
+}
+//
+//  Takes the eight SAME bytes of a chunk read at address into rxBuffer and rxConfidence,
+//  where the Header is put together across chunks.
+//
+void SI4707::sameChunk(const SameChunk &chunk, uint8_t address)
+{
+  uint8_t j;
+  
+  for (j = 0; j + address < sameLength && j < 8; j++)
+    {
+      rxBuffer[j + address] = chunk.text(j);
+      rxConfidence[j + address] = chunk.confidence(j);
+      
+      if (chunk.text(j) < 0x2B  || chunk.text(j) > 0x7F)
+        {
+          sameLength = j + address;
+          break;
+        }
+    }
+}
+//
+//  Gets the current ASQ Status.
+//
+void SI4707::getAsqStatus(uint8_t mode)
+{
+  AsqStatus status;
+  
+  if (getAsqStatus(mode, status))
+    statusApply(status);
+}
+//
+//  Reads the current ASQ Status into status, returns 0 if it could not be read.
+//
+uint8_t SI4707::getAsqStatus(uint8_t mode, AsqStatus &status)
+{
+  Response<3> r;
+  
+  writeByte(WB_ASQ_STATUS, mode);
+  
+  if (!readResponse(r))
+    return 0;
+  
+  statusDecode(r, status);
+  return 1;
+}
+//
+//  Decodes an ASQ Status response.
+//
+void SI4707::statusDecode(const Response<3> &r, AsqStatus &status)
+{
+  status.status = r[0];
+  status.interrupts = r[1];
+  status.alert = r[2];
+}
+//
+//  Takes an ASQ Status into asqStatus, the SAME message state and the rules.
+//
+void SI4707::statusApply(const AsqStatus &status)
+{
+  asqStatus = status.interrupts;
+  
+  if (status.alert & ALERT && sameMessageState == SAME_HEADER)  //  The Alert Tone follows the last Header.
+    {
+      sameMessageState = SAME_COMPLETE;
+      sameTimer = millis();
+    }
+  
+  if (asqStatus == ruleAsq)
+    return;
+  
+  if (asqStatus & ALERTON)
+    ruleEvaluate(RULE_ALERTON);
+  
+  if (asqStatus & ALERTOF)
+    ruleEvaluate(RULE_ALERTOF);
+  
+  ruleAsq = asqStatus;
+}
+//
+//  Gets the current AGC Status.
+//
+void SI4707::getAgcStatus(void)
+{
+  Response<2> r;
+  
+  writeCommand(WB_AGC_STATUS);
+  
+  if (!readResponse(r))
+    return;
+  
+  agcStatus = r[1];
+}
+//
+//  Sets the audio volume level, queued as setProperty().
+//
+uint8_t SI4707::setVolume(uint16_t volume)
+{
+  if (volume < 0x0000 || volume > 0x003F)
+    return 0;
+     
+  return setProperty(RX_VOLUME, volume);
+}
+//
+//  Sets the current Mute state, queued as setProperty().
+//
+uint8_t SI4707::setMute(uint8_t value)
+{
+  switch (value)
+    {
+      case OFF:
+                return setProperty(RX_HARD_MUTE, 0x0000);
+
+      case ON:
+                return setProperty(RX_HARD_MUTE, 0x0003);
+        
+      default:
+                return 0;      
+    }
+}
+//
+//  Sets a specified property value, queued for tick() so loop() never waits on it.
+//  Returns a handle for queueDone(), 0 if it is only cached (queue full, or in Standby).
+//
+uint8_t SI4707::setProperty(uint16_t property, uint16_t value)
+{
+  return queueProperty(property, value, QUEUE_NORMAL);
+}
+//
+//  Caches a property value for restore(), keeping mute in step with RX_HARD_MUTE.
+//  Returns 0 if it must not be written yet, because resume() will apply it.
+//
+uint8_t SI4707::propertyRemember(uint16_t property, uint16_t value)
+{
+  uint8_t i;
+  
+  for (i = 0; i < propertyCount && propertyId[i] != property; i++)
+    ;
+  
+  if (i < PROPERTY_CACHE)
+    {
+      propertyId[i] = property;
+      propertyValue[i] = value;
+      
+      if (i == propertyCount)
+        propertyCount++;
+    }
+  
+  if (property == RX_HARD_MUTE)
+    mute = value ? ON : OFF;
+  
+  return !(power == STANDBY && (property == GPO_IEN || property == RX_HARD_MUTE));
+}
+//
+//  Returns the cached value of a property, or value if it was never set.
+//
+uint16_t SI4707::propertyCached(uint16_t property, uint16_t value)
+{
+  for (uint8_t i = 0; i < propertyCount; i++)
+    if (propertyId[i] == property)
+      return propertyValue[i];
+  
+  return value;
+}
+//
+//  Writes a property without caching it, returns 0 if the write failed.
+//
+uint8_t SI4707::writeProperty(uint16_t property, uint16_t value)
+{
+  waitClear();
+  
+  uint8_t args[6] = { SET_PROPERTY, 0x00, highByte(property), lowByte(property), highByte(value), lowByte(value) };
+  uint8_t sent = i2cWrite(args, sizeof(args));
+  
+  delay(PROP_DELAY);
+  return sent;
+}
+//
+//  Returns a specified property value.
+//
+uint16_t SI4707::getProperty(uint16_t property)
+{
+  uint16_t value;
+  
+  if (!readProperties(&property, &value, 1))
+    return 0;
+  
+  return value;
+}
+//
+//  Reads count properties into values, one GET_PROPERTY query() after another,
+//  each as soon as the Si4707 has it.  Returns the number read, stopping at the
+//  first that fails or that the Si4707 rejects with ERRINT.
+//
+uint8_t SI4707::readProperties(const uint16_t *properties, uint16_t *values, uint8_t count)
+{
+  uint8_t args[4] = { GET_PROPERTY, 0x00 };
+  Response<4> r;
+  uint8_t i;
+  
+  for (i = 0; i < count; i++)
+    {
+      args[2] = highByte(properties[i]);
+      args[3] = lowByte(properties[i]);
+      
+      if (!query(args, sizeof(args), r.raw, sizeof(r.raw)))
+        break;
+      
+      values[i] = r.word(2);
+    }
+  
+  return i;
+}
+//
+//  Reads the revision and every property in DIAG_PROPERTY, each on its own.
+//  Returns 0 if any of it could not be read, diagnostics.revisionRead and
+//  diagnostics.properties say what was.
+//
+uint8_t SI4707::getDiagnostics(Diagnostics &diagnostics)
+{
+  memcpy(diagnostics.propertyId, DIAG_PROPERTY, sizeof(DIAG_PROPERTY));
+  
+  diagnostics.revisionRead = getRevision(diagnostics.revision);
+  diagnostics.properties = readProperties(DIAG_PROPERTY, diagnostics.propertyValue, DIAG_PROPERTIES);
+  
+  return diagnostics.revisionRead && diagnostics.properties == DIAG_PROPERTIES;
+}
+//
+//  Controls a specified GPIO.
+//
+void SI4707::gpioControl(uint8_t value)
+{
+  writeByte(GPIO_CTL, value);
+}
+//
+//  Sets a specified GPIO, queued for tick().  Returns a handle for queueDone(), 0 if the queue is full.
+//
+uint8_t SI4707::gpioSet(uint8_t value)
+{
+  return queueGpioSet(value, QUEUE_NORMAL);
+}  
+//
+//  Queues a command for tick() to send.  Returns a handle for queueDone(),
+//  or 0 if the queue is full.
+//
+uint8_t SI4707::queueCommand(const uint8_t *args, uint8_t length, uint8_t priority)
+{
+  uint8_t i;
+  
+  if (length == 0 || length > QUEUE_ARGS)
+    return 0;
+  
+  for (i = 0; i < QUEUE_SIZE && queue[i].handle; i++)
+    ;
+  
+  if (i == QUEUE_SIZE)
+    return 0;
+  
+  do
+    {
+      if (++queueHandle == 0)                    //  Handles are never 0, nor one still queued.
+        queueHandle = 1;
+    }
+  while (!queueDone(queueHandle));
+  
+  queue[i].handle = queueHandle;
+  queue[i].priority = priority;
+  queue[i].length = length;
+  memcpy(queue[i].args, args, length);
+  queueFill++;
+  
+  return queueHandle;
+}
+//
+//  Queues a property write, it is cached for restore() right away.
+//
+uint8_t SI4707::queueProperty(uint16_t property, uint16_t value, uint8_t priority)
+{
+  uint8_t args[QUEUE_ARGS] = { SET_PROPERTY, 0x00, highByte(property), lowByte(property), highByte(value), lowByte(value) };
+  
+  if (!propertyRemember(property, value))
+    return 0;
+  
+  return queueCommand(args, sizeof(args), priority);
+}
+//
+//  Queues a GPO level change.
+//
+uint8_t SI4707::queueGpioSet(uint8_t value, uint8_t priority)
+{
+  uint8_t args[2] = { GPIO_SET, value };
+  
+  return queueCommand(args, sizeof(args), priority);
+}
+//
+//  Returns 1 once the queued command has been sent.
+//
+uint8_t SI4707::queueDone(uint8_t handle)
+{
+  for (uint8_t i = 0; i < QUEUE_SIZE; i++)
+    if (queue[i].handle == handle)
+      return 0;
+  
+  return 1;
+}
+//
+//  Drives the Si4707 from loop() a transaction or two at a time, never delaying.
+//  The status the interrupts ask for is read first, a step per call:  INTAVL,
+//  a sameFlush(), SAMEINT and the Header behind it, ASQINT, RSQINT, an RSQ check
+//  and STCINT, each read leaving its bit in statusRead (RSQINT for rsqService()).
+//  Only then is a queued command sent, highest priority first, when the Si4707
+//  is Clear To Send.  A failed transfer is not retried or recovered here but
+//  left for the next tick().  Returns the number of commands still queued,
+//  plus one while status is being read.
+//
+uint8_t SI4707::tick(void)
+{
+  uint8_t i, next = QUEUE_SIZE;
+  
+  if (!power)
+    return queueFill;
+  
+  if (stepCommand)                               //  Read the response of the last step.
+    {
+      stepPoll();
+      return queueFill + stepBusy();
+    }
+  
+  if (stepBusy())
+    {
+      if (clearToSend())
+        stepStart();
+      
+      return queueFill + 1;
+    }
+  
+  if (!queueFill || !clearToSend())
+    return queueFill;
+  
+  for (i = 0; i < QUEUE_SIZE; i++)               //  Oldest of the highest priority.
+    {
+      if (!queue[i].handle)
+        continue;
+      
+      if (next == QUEUE_SIZE || queue[i].priority < queue[next].priority ||
+          (queue[i].priority == queue[next].priority && int8_t(queue[i].handle - queue[next].handle) < 0))
+        next = i;
+    }
+  
+  if (!i2cWrite(queue[next].args, queue[next].length, 0))  //  Leave it queued for the next tick().
+    return queueFill;
+  
+  if (queue[next].args[0] == WB_AGC_OVERRIDE)
+    agcStatus = queue[next].args[1];
+  
+  queue[next].handle = 0;
+  queueFill--;
+  queueSent = 1;                                 //  The next inline command waits for CTS.
+  
+  return queueFill;
+}
+//
+//  Returns 1 while tick() has status to read.
+//
+uint8_t SI4707::stepBusy(void)
+{
+  return stepCommand || stepWanted || stepChunk != STEP_NONE || intStatus & (INTAVL | SAMEINT | ASQINT | RSQINT | STCINT);
+}
+//
+//  Sends the command of the next status read, the response is left for stepPoll().
+//
+void SI4707::stepStart(void)
+{
+  uint8_t args[3] = { WB_SAME_STATUS, INTACK, 0x00 };
+  uint8_t length = 2;
+  
+  if (intStatus & INTAVL)
+    {
+      args[0] = GET_INT_STATUS;
+      length = 1;
+      intStatus &= ~INTAVL;                      //  Taken now, an interrupt from here on sets it again.
+    }
+  
+  else if (stepWanted & STEP_SAME_FLUSH)
+    {
+      args[1] = CLRBUF | INTACK;
+      length = 3;
+      stepWanted &= ~STEP_SAME_FLUSH;
+    }
+  
+  else if (stepChunk != STEP_NONE)
+    {
+      args[1] = CHECK;
+      args[2] = stepChunk;
+      length = 3;
+    }
+  
+  else if (intStatus & SAMEINT)
+    length = 3;
+  
+  else if (intStatus & ASQINT)
+    args[0] = WB_ASQ_STATUS;
+  
+  else if (intStatus & RSQINT)
+    args[0] = WB_RSQ_STATUS;
+  
+  else if (stepWanted & STEP_RSQ_CHECK)
+    {
+      args[0] = WB_RSQ_STATUS;
+      args[1] = CHECK;
+    }
+  
+  else if (intStatus & STCINT)
+    args[0] = WB_TUNE_STATUS;
+  
+  else
+    return;
+  
+  if (!i2cWrite(args, length, 0))                //  Ask again next tick().
+    {
+      if (args[0] == GET_INT_STATUS)
+        intStatus |= INTAVL;
+      
+      if (args[1] == (CLRBUF | INTACK))
+        stepWanted |= STEP_SAME_FLUSH;
+      
+      return;
+    }
+  
+  stepCommand = args[0];
+  stepMode = args[1];
+  stepAddress = args[2];
+  stepDrop = 0;
+  stepTimer = millis();
+  queueSent = 1;                                 //  An inline command first takes the response.
+}
+//
+//  Reads the response of the step under way.  Returns 1 once the step is
+//  over, done or given up after PROP_DELAY msec, 0 while it is not ready.
+//
+uint8_t SI4707::stepPoll(void)
+{
+  uint8_t quantity;
+  
+  switch (stepCommand)
+    {
+      case GET_INT_STATUS:  quantity = sizeof(stepResponse.status);  break;
+      case WB_ASQ_STATUS:   quantity = sizeof(stepResponse.asq);     break;
+      case WB_RSQ_STATUS:   quantity = sizeof(stepResponse.rsq);     break;
+      case WB_TUNE_STATUS:  quantity = sizeof(stepResponse.tune);    break;
+      default:              quantity = (stepMode == CHECK) ? sizeof(stepResponse.chunk) : sizeof(stepResponse.same);  break;
+    }
+  
+  if (i2cRead(stepResponse.chunk.raw, quantity, 0) && stepResponse.chunk.raw[0] & CTSINT)
+    {
+      uint8_t status = stepResponse.chunk.raw[0];
+      
+      intStatus = status | (intStatus & INTAVL);   //  The interrupt handler may have set it meanwhile.
+      
+      if (stepDrop)
+        ;
+      
+      else if (stepCommand == GET_INT_STATUS)
+        statusRead |= status & ERRINT;
+      
+      else if (status & ERRINT)                  //  Rejected, the next interrupt tells again what is pending.
+        {
+          intStatus &= ~(SAMEINT | ASQINT | RSQINT | STCINT);
+          stepWanted &= ~STEP_RSQ_CHECK;
+          stepChunk = STEP_NONE;
+        }
+      
+      else
+        stepDone();
+      
+      stepCommand = 0;
+      return 1;
+    }
+  
+  if (millis() - stepTimer < PROP_DELAY)
+    return 0;
+  
+  if (stepCommand == GET_INT_STATUS)             //  Given up, the interrupt bits stay to be read again.
+    intStatus |= INTAVL;
+  
+  if (stepCommand == WB_SAME_STATUS && stepMode == (CLRBUF | INTACK))
+    stepWanted |= STEP_SAME_FLUSH;
+  
+  stepCommand = 0;
+  return 1;
+}
+//
+//  Takes a step's response into the driver, reporting it in statusRead.
+//
+void SI4707::stepDone(void)
+{
+  TuneStatus tune;
+  RsqStatus rsq;
+  AsqStatus asq;
+  
+  switch (stepCommand)
+    {
+      case WB_TUNE_STATUS:
+                statusDecode(stepResponse.tune, tune);
+                statusApply(tune);
+                statusRead |= STCINT;
+                break;
+      
+      case WB_RSQ_STATUS:
+                statusDecode(stepResponse.rsq, rsq);
+                statusApply(rsq);
+                stepWanted &= ~STEP_RSQ_CHECK;   //  Fresh either way.
+                rsqPending |= (stepMode == INTACK);
+                break;
+      
+      case WB_ASQ_STATUS:
+                statusDecode(stepResponse.asq, asq);
+                statusApply(asq);
+                statusRead |= ASQINT;
+                break;
+      
+      default:
+                if (stepMode != CHECK)           //  The SAME Status, the Header is read next if there is one.
+                  {
+                    if (sameUpdate(stepResponse.same, stepMode))
+                      stepChunk = 0;
+                    
+                    else if (!(stepMode & CLRBUF))
+                      statusRead |= SAMEINT;
+                    
+                    break;
+                  }
+                
+                sameChunk(stepResponse.chunk, stepAddress);
+                
+                if (stepAddress + 8 < sameLength && stepAddress + 8 < SAME_BUFFER_SIZE)
+                  {
+                    stepChunk = stepAddress + 8;
+                    break;
+                  }
+                
+                stepChunk = STEP_NONE;
+                sameCheck();
+                statusRead |= SAMEINT;
+                break;
+    }
+}
+//
+//  Encodes the last parsed Header (FRAME_ALERT) or just the signal quality
+//  (FRAME_SIGNAL) as a binary frame, see SI4707Frame.h.  Returns the frame
+//  length, or 0 if it does not fit in size bytes.
+//
+uint16_t SI4707::frameEncode(uint8_t type, uint8_t *buffer, uint16_t size)
+{
+  uint16_t i = 4, crc;
+  uint8_t j, n;
+  
+  if (size < (type == FRAME_ALERT ? FRAME_MAX_SIZE : FRAME_OVERHEAD + 7))
+    return 0;
+  
+  buffer[0] = FRAME_SYNC;
+  buffer[1] = type;
+  
+  if (type == FRAME_ALERT)
+    {
+      memcpy(&buffer[i], sameOriginatorName, 3);
+      memcpy(&buffer[i + 3], sameEventName, 3);
+      buffer[i + 6] = highByte(sameDuration);
+      buffer[i + 7] = lowByte(sameDuration);
+      buffer[i + 8] = highByte(sameDay);
+      buffer[i + 9] = lowByte(sameDay);
+      buffer[i + 10] = highByte(sameTime);
+      buffer[i + 11] = lowByte(sameTime);
+      i += 12;
+      
+      n = strlen(sameCallSign);
+      buffer[i++] = n;
+      memcpy(&buffer[i], sameCallSign, n);
+      i += n;
+      
+      n = sameLocations < FRAME_LOCATIONS ? sameLocations : FRAME_LOCATIONS;
+      buffer[i++] = n;
+      
+      for (j = 0; j < n; j++, i += 3)
+        {
+          buffer[i] = sameLocationCodes[j] >> 16;
+          buffer[i + 1] = sameLocationCodes[j] >> 8;
+          buffer[i + 2] = sameLocationCodes[j];
+        }
+    }
+  
+  buffer[i] = highByte(channel);
+  buffer[i + 1] = lowByte(channel);
+  buffer[i + 2] = rssi;
+  buffer[i + 3] = snr;
+  buffer[i + 4] = int8_t(freqoff);
+  buffer[i + 5] = rsqStatus;
+  buffer[i + 6] = asqStatus;
+  i += 7;
+  
+  buffer[2] = highByte(i - 4);
+  buffer[3] = lowByte(i - 4);
+  
+  crc = crc16(&buffer[1], i - 1);
+  buffer[i++] = highByte(crc);
+  buffer[i++] = lowByte(crc);
+  
+  return i;
+}
+//
+//  Encodes the same content as frameEncode() as one line of JSON.
+//  Returns its length, or 0 if it does not fit in size bytes.
+//
+uint16_t SI4707::jsonEncode(uint8_t type, char *buffer, uint16_t size)
+{
+  uint16_t length = 0;
+  uint8_t i, ok = 1;
+  
+  if (type == FRAME_ALERT)
+    {
+      ok = ok && jsonText(buffer, size, length, "{\"originator\":\"");
+      ok = ok && jsonString(buffer, size, length, sameOriginatorName);
+      ok = ok && jsonText(buffer, size, length, "\",\"event\":\"");
+      ok = ok && jsonString(buffer, size, length, sameEventName);
+      ok = ok && jsonText(buffer, size, length, "\",\"locations\":[");
+      
+      for (i = 0; i < sameLocations && i < FRAME_LOCATIONS; i++)
+        {
+          if (i)
+            ok = ok && jsonText(buffer, size, length, ",");
+          
+          ok = ok && jsonNumber(buffer, size, length, sameLocationCodes[i]);
+        }
+      
+      ok = ok && jsonText(buffer, size, length, "],\"duration\":");
+      ok = ok && jsonNumber(buffer, size, length, sameDuration);
+      ok = ok && jsonText(buffer, size, length, ",\"day\":");
+      ok = ok && jsonNumber(buffer, size, length, sameDay);
+      ok = ok && jsonText(buffer, size, length, ",\"time\":");
+      ok = ok && jsonNumber(buffer, size, length, sameTime);
+      ok = ok && jsonText(buffer, size, length, ",\"callsign\":\"");
+      ok = ok && jsonString(buffer, size, length, sameCallSign);
+      ok = ok && jsonText(buffer, size, length, "\",");
+    }
+  
+  else
+    ok = ok && jsonText(buffer, size, length, "{");
+  
+  ok = ok && jsonText(buffer, size, length, "\"channel\":");
+  ok = ok && jsonNumber(buffer, size, length, channel);
+  ok = ok && jsonText(buffer, size, length, ",\"rssi\":");
+  ok = ok && jsonNumber(buffer, size, length, rssi);
+  ok = ok && jsonText(buffer, size, length, ",\"snr\":");
+  ok = ok && jsonNumber(buffer, size, length, snr);
+  ok = ok && jsonText(buffer, size, length, ",\"freqoff\":");
+  ok = ok && jsonNumber(buffer, size, length, freqoff);
+  ok = ok && jsonText(buffer, size, length, ",\"rsq\":");
+  ok = ok && jsonNumber(buffer, size, length, rsqStatus);
+  ok = ok && jsonText(buffer, size, length, ",\"asq\":");
+  ok = ok && jsonNumber(buffer, size, length, asqStatus);
+  ok = ok && jsonText(buffer, size, length, "}\n");
+  
+  return ok ? length : 0;
+}
+//
+//  Return available character count.
+//
+int SI4707::sameAvailable(void)
+{
+  if (rxBufferIndex == rxBufferLength)
+    return -1;
+  
+  else
+    return rxBufferLength - rxBufferIndex;
+}  
+//
+//  Return received characters.
+//
+char SI4707::sameRead(void)
+{
+  char value = 0x00;
+       
+  if (rxBufferIndex < rxBufferLength)  
+    {
+      value = rxBuffer[rxBufferIndex];
+      rxBufferIndex++;          
+    }
+  
+  else
+    {
+      rxBufferIndex = rxBufferLength = 0;
+      msgStatus |= MSGUSD;
+    }  
+    
+  return value;
+}
+//
+//  The SAME message is parsed here.
+//
+void SI4707::sameParse(void)
+{
+  if (!(msgStatus & MSGAVL))                     //  If no message is Available, return
+    return;
+          
+  headerCurrent = 0;                             //  The fields below are overwritten from here on.
+  samePlusIndex = 0;
+  sameLocations = 0;
+  sameDuration = 0;
+  sameDay = 0;
+  sameTime = 0;
+  
+  uint8_t i = 0;
+    
+  sameOriginatorName[0] = rxBuffer[i + 1];
+  sameOriginatorName[1] = rxBuffer[i + 2];
+  sameOriginatorName[2] = rxBuffer[i + 3];
+  sameOriginatorName[3] = 0x00;
+  
+  sameEventName[0] = rxBuffer[i + 5];
+  sameEventName[1] = rxBuffer[i + 6];
+  sameEventName[2] = rxBuffer[i + 7];
+  sameEventName[3] = 0x00;
+  
+  for (i = 0; i < sizeof(rxBuffer); i++)         //  Look for the Plus Sign.
+    {
+      if (rxBuffer[i] == 0x2B)
+        samePlusIndex = i;                       //  Found it.
+    }  
+  
+  if (samePlusIndex == 0)                        //  No Plus Sign found.
+    return;
+  
+  for (i = 0; i < 8; i++)                        //  The Call Sign keeps its digits, copy it before they are stripped.
+    {
+      if (samePlusIndex + 14 + i >= SAME_BUFFER_SIZE ||
+          rxBuffer[i + samePlusIndex + 14] == 0x2D || rxBuffer[i + samePlusIndex + 14] == 0x00)
+        break;
+      
+      sameCallSign[i] = rxBuffer[i + samePlusIndex + 14];
+    }
+  
+  sameCallSign[i] = 0x00;
+  
+  for (i = 0; i < sizeof(rxBuffer); i++)
+    {
+      if (rxBuffer[i] >= 0x30 && rxBuffer[i] <= 0x39) //  If the value is ascii, strip off the upper bits.
+        rxBuffer[i] = rxBuffer[i] & 0x0F;
+    }  
+  
+  for (i = 6; i < samePlusIndex; i++)            //  There are no sameLocationCodes past the samePlusIndex.   
+    {
+      if (rxBuffer[i] == 0x2D)  
+        {
+          if (sameLocations > SAME_LOCATION_CODES) //  SAME_LOCATION_CODES (31) is the maximum allowed.
+            break;
+          
+          sameLocationCodes[sameLocations] = 0;  //  Clear out any remaining data.
+          sameLocationCodes[sameLocations] += rxBuffer[i + 1] * 100000UL;
+          sameLocationCodes[sameLocations] += rxBuffer[i + 2] *  10000UL;
+          sameLocationCodes[sameLocations] += rxBuffer[i + 3] *   1000UL;
+          sameLocationCodes[sameLocations] += rxBuffer[i + 4] *    100UL;
+          sameLocationCodes[sameLocations] += rxBuffer[i + 5] *     10UL;
+          sameLocationCodes[sameLocations] += rxBuffer[i + 6] *      1UL;
+          sameLocations++;
+        }
+    }  
+  
+  sameDuration += rxBuffer[samePlusIndex + 1] * 600;
+  sameDuration += rxBuffer[samePlusIndex + 2] *  60;
+  sameDuration += rxBuffer[samePlusIndex + 3] *  10;
+  sameDuration += rxBuffer[samePlusIndex + 4] *   1;
+
+  sameDay += rxBuffer[samePlusIndex + 6] * 100;
+  sameDay += rxBuffer[samePlusIndex + 7] *  10;
+  sameDay += rxBuffer[samePlusIndex + 8] *   1;
+
+  sameTime += rxBuffer[samePlusIndex +  9] * 1000;
+  sameTime += rxBuffer[samePlusIndex + 10] *  100;
+  sameTime += rxBuffer[samePlusIndex + 11] *   10;
+  sameTime += rxBuffer[samePlusIndex + 12] *    1;
+  
+  frontDecoded();                                //  A repeat was still decoded cleanly.
+  
+  headerCurrent = 1;
+  
+  if (dedupCheck())                              //  Already seen, mark it used without reporting it again.
+    {
+      msgStatus |= (MSGUSD | MSGDUP);
+      return;
+    }
+  
+  msgStatus |= (MSGUSD | MSGPAR);                // Set the status to show the message was successfully Parsed.
+  
+  historyAdd();
+  channelSame();
+  logAppend(LOG_ALERT, historyGet(0), sizeof(SameRecord));
+  ruleEvaluate(RULE_HEADER);
+}
+//
+//  Flush the SAME receive data.
+//
+void SI4707::sameFlush(void)
+{
+  stepWanted |= STEP_SAME_FLUSH;                 //  tick() clears the Si4707's buffer.
+  stepDrop = (stepCommand == WB_SAME_STATUS);    //  A read under way belongs to what is flushed.
+  stepChunk = STEP_NONE;
+  
+  for (uint8_t i = 0; i < SAME_BUFFER_SIZE; i++)
+    {
+      rxBuffer[i] = 0x00;
+      rxConfidence[i] = 0x00;
+    }
+
+  msgStatus = 0x00;
+  sameHeaderCount = sameLength = 0;
+  rxBufferIndex = rxBufferLength = 0;
+  sameMessageState = SAME_IDLE;
+}
+//
+//  Advances the SAME message state, flushing only between messages.
+//
+void SI4707::sameService(void)
+{
+  switch (sameMessageState)
+    {
+      case SAME_PREAMBLE:
+      case SAME_HEADER:
+                if (millis() - sameTimer >= SAME_TIME_OUT * 1000UL)  //  A stalled Header, start over.
+                  sameFlush();
+                break;
+
+      case SAME_COMPLETE:
+                if (!(msgStatus & MSGAVL) || msgStatus & MSGUSD || millis() - sameTimer >= SAME_TIME_OUT * 1000UL)
+                  sameFlush();
+                break;
+
+      case SAME_EOM:
+                sameFlush();
+                break;
+
+      default:
+                break;
+    }
+}
+//
+//  Compiles a rule table into the lookup used while servicing interrupts.
+//  Returns the number of rules loaded.
+//
+uint8_t SI4707::ruleLoad(const SameRule *rules, uint8_t count)
+{
+  uint8_t i;
+  uint8_t enable = 0x00;
+  
+  ruleClear();
+  
+  for (i = 0; i < count && ruleCount < RULE_MAX; i++)
+    {
+      if (rules[i].trigger >= RULE_TRIGGERS)
+        continue;
+      
+      ruleTable[ruleCount].event = samePack(rules[i].event);
+      ruleTable[ruleCount].originator = samePack(rules[i].originator);
+      ruleTable[ruleCount].location = rules[i].location;
+      ruleTable[ruleCount].action = rules[i].action;
+      ruleTable[ruleCount].value = rules[i].value;
+      ruleIndex[rules[i].trigger] |= (1 << ruleCount);
+      
+      if (rules[i].action == RULE_GPO_HIGH || rules[i].action == RULE_GPO_LOW)
+        enable |= rules[i].value & (GPO1OEN | GPO3OEN);
+      
+      ruleCount++;
+    }
+  
+  if (enable)
+    gpioControl(enable);
+  
+  return ruleCount;
+}
+//
+//  Unloads all rules.
+//
+void SI4707::ruleClear(void)
+{
+  for (uint8_t i = 0; i < RULE_TRIGGERS; i++)
+    ruleIndex[i] = 0x0000;
+  
+  ruleCount = 0;
+}
+//
+//  Performs the actions of every rule matching the trigger and the last parsed Header.
+//  The actions are queued, tick() sends them once the SAME interrupts are serviced.
+//
+void SI4707::ruleEvaluate(uint8_t trigger)
+{
+  uint16_t index = ruleIndex[trigger];
+  uint32_t event = samePack(sameEventName);
+  uint32_t originator = samePack(sameOriginatorName);
+  uint8_t i, j;
+  
+  for (i = 0; index; i++, index >>= 1)
+    {
+      if (!(index & 0x0001))
+        continue;
+      
+      RuleEntry &rule = ruleTable[i];
+      
+      if (!headerCurrent && (rule.event || rule.originator || rule.location))  //  The filters would test an older message.
+        continue;
+      
+      if (rule.event && rule.event != event)
+        continue;
+      
+      if (rule.originator && rule.originator != originator)
+        continue;
+      
+      if (rule.location)
+        {
+          for (j = 0; j < sameLocations; j++)
+            if (sameLocationMatch(sameLocationCodes[j], rule.location))
+              break;
+          
+          if (j == sameLocations)
+            continue;
+        }
+      
+      switch (rule.action)
+        {
+          case RULE_MUTE:
+                    if (rule.value == ON || rule.value == OFF)
+                      queueProperty(RX_HARD_MUTE, rule.value == ON ? 0x0003 : 0x0000, QUEUE_HIGH);
+                    break;
+          
+          case RULE_VOLUME:
+                    if (rule.value <= 0x003F)
+                      queueProperty(RX_VOLUME, rule.value, QUEUE_HIGH);
+                    break;
+          
+          case RULE_GPO_HIGH:
+                    gpoLevel |= rule.value;
+                    queueGpioSet(gpoLevel, QUEUE_HIGH);
+                    break;
+          
+          case RULE_GPO_LOW:
+                    gpoLevel &= ~rule.value;
+                    queueGpioSet(gpoLevel, QUEUE_HIGH);
+                    break;
+          
+          default:
+                    break;
+        }
+    }
+}
+//
+//  Forgets all remembered alerts.
+//
+void SI4707::dedupClear(void)
+{
+  for (uint8_t i = 0; i < SAME_DEDUP_SIZE; i++)
+    dedupHash[i] = dedupStamp[i] = dedupLife[i] = 0;
+}
+//
+//  Hashes the parsed Header into sameHash and remembers it until its purge time expires.
+//  Returns 1 if the same alert was already remembered.
+//
+uint8_t SI4707::dedupCheck(void)
+{
+  uint32_t now = millis();
+  uint8_t i, slot = 0;
+  
+  sameHash = 2166136261UL;
+  sameHash = sameHashAdd(sameHash, sameOriginatorName, 3);
+  sameHash = sameHashAdd(sameHash, sameEventName, 3);
+  sameHash = sameHashAdd(sameHash, sameLocationCodes, sameLocations * sizeof(uint32_t));
+  sameHash = sameHashAdd(sameHash, &sameDay, sizeof(sameDay));
+  sameHash = sameHashAdd(sameHash, &sameTime, sizeof(sameTime));
+  sameHash = sameHashAdd(sameHash, sameCallSign, strlen(sameCallSign));
+  
+  for (i = 0; i < SAME_DEDUP_SIZE; i++)
+    {
+      if (now - dedupStamp[i] >= dedupLife[i])   //  Expired, free to reuse.
+        {
+          dedupLife[i] = 0;
+          slot = i;
+          continue;
+        }
+      
+      if (dedupHash[i] == sameHash)
+        return 1;
+      
+      if (dedupLife[slot] && dedupStamp[i] - dedupStamp[slot] > 0x7FFFFFFFUL)  //  Otherwise replace the oldest.
+        slot = i;
+    }
+  
+  dedupHash[slot] = sameHash;
+  dedupStamp[slot] = now;
+  dedupLife[slot] = (sameDuration > SAME_DEDUP_MIN ? sameDuration : SAME_DEDUP_MIN) * 60000UL;
+  
+  return 0;
+}
+//
+//  Returns the number of alerts in the history.
+//
+uint8_t SI4707::historyCount(void)
+{
+  return historyFill;
+}
+//
+//  Returns the n-th most recent alert, 0 being the newest, or NULL.
+//
+const SameRecord *SI4707::historyGet(uint8_t n)
+{
+  if (n >= historyFill)
+    return NULL;
+  
+  return &historyRing[(historyHead + SAME_HISTORY_SIZE - 1 - n) % SAME_HISTORY_SIZE];
+}
+//
+//  Fills list with up to max unexpired alerts covering a location, newest first.
+//  A location of 0 matches every alert.  A truncated record that doesn't list the
+//  location may still cover it, so it is included.  Returns the number found.
+//
+uint8_t SI4707::historyActive(uint32_t location, const SameRecord **list, uint8_t max)
+{
+  uint32_t now = millis();
+  uint8_t i, j, found = 0;
+  
+  for (i = 0; i < historyFill && found < max; i++)
+    {
+      const SameRecord *record = historyGet(i);
+      
+      if (now - record->received >= record->duration * 60000UL)
+        continue;
+      
+      if (location)
+        {
+          for (j = 0; j < record->locations && j < SAME_HISTORY_LOCATIONS; j++)
+            if (sameLocationMatch(historyLocation(record, j), location))
+              break;
+          
+          if ((j == record->locations || j == SAME_HISTORY_LOCATIONS) && !historyTruncated(record))
+            continue;
+        }
+      
+      list[found++] = record;
+    }
+  
+  return found;
+}
+//
+//  Unpacks the n-th location code of a record, 0 if it was not kept.
+//
+uint32_t SI4707::historyLocation(const SameRecord *record, uint8_t n)
+{
+  uint32_t code = 0;
+  uint16_t bit = n * 21;
+  uint8_t i;
   
-  value |= (response[2] << 8 | response[3]);
+  if (n >= record->locations || n >= SAME_HISTORY_LOCATIONS)
+    return 0;
   
-  return value;
+  for (i = 0; i < 21; i++, bit++)
+    if (record->locationCodes[bit >> 3] & (0x01 << (bit & 0x07)))
+      code |= (1UL << i);
+  
+  return (code >> 17) * 100000UL + ((code >> 10) & 0x7F) * 1000UL + (code & 0x03FF);
 }
 //
-//  Controls a specified GPIO.
+//  Returns 1 if the Header had more location codes than the record could keep.
 //
-void SI4707::gpioControl(uint8_t value)
+uint8_t SI4707::historyTruncated(const SameRecord *record)
 {
-  writeByte(GPIO_CTL, value);
+  return record->locations > SAME_HISTORY_LOCATIONS;
 }
 //
-//  Sets a specified GPIO.
+//  Empties the history.
 //
-void SI4707::gpioSet(uint8_t value)
+void SI4707::historyClear(void)
 {
-  writeByte(GPIO_SET, value);
-}  
+  historyHead = historyFill = 0;
+}
 //
-//  Return available character count.
+//  Returns the three letter code for a SameRecord event, or "???".
 //
-int SI4707::sameAvailable(void)
+const char *SI4707::sameEventCode(uint8_t event)
 {
-  if (rxBufferIndex == rxBufferLength)
-    return -1;
+  if (event == 0 || event > SAME_EVENT_CODES)
+    return "???";
   
-  else
-    return rxBufferLength - rxBufferIndex;
-}  
+  return SAME_EVENT_CODE[event - 1];
+}
 //
-//  Return received characters.
+//  Packs the just parsed Header into the history ring.
 //
-char SI4707::sameRead(void)
+void SI4707::historyAdd(void)
 {
-  char value = 0x00;
-       
-  if (rxBufferIndex < rxBufferLength)  
+  SameRecord &record = historyRing[historyHead];
+  uint16_t bit = 0;
+  uint8_t i, j;
+  
+  memset(&record, 0, sizeof(record));
+  
+  record.hash = sameHash;
+  record.received = millis();
+  record.issued = (sameTime / 100) * 60 + sameTime % 100;
+  record.day = sameDay;
+  record.duration = sameDuration;
+  record.locations = sameLocations;
+  record.rssi = rssi;
+  record.snr = snr;
+  
+  for (i = 0; i < SAME_EVENT_CODES; i++)
+    if (strncmp(sameEventName, SAME_EVENT_CODE[i], 3) == 0)
+      {
+        record.event = i + 1;
+        break;
+      }
+  
+  if (strcmp(sameOriginatorName, "EAS") == 0)
+    record.originator = ORG_EAS;
+  else if (strcmp(sameOriginatorName, "CIV") == 0)
+    record.originator = ORG_CIV;
+  else if (strcmp(sameOriginatorName, "WXR") == 0)
+    record.originator = ORG_WXR;
+  else if (strcmp(sameOriginatorName, "PEP") == 0)
+    record.originator = ORG_PEP;
+  
+  for (i = 0; i < sizeof(record.callSign) && sameCallSign[i]; i++)
+    record.callSign[i] = sameCallSign[i];
+  
+  for (i = 0; i < sameLocations && i < SAME_HISTORY_LOCATIONS; i++)
     {
-      value = rxBuffer[rxBufferIndex];
-      rxBufferIndex++;          
+      uint32_t code = sameLocationCodes[i];
+      uint32_t packed = (code / 100000UL) << 17 | ((code / 1000UL) % 100) << 10 | (code % 1000UL);
+      
+      for (j = 0; j < 21; j++, bit++)
+        if (packed & (1UL << j))
+          record.locationCodes[bit >> 3] |= (0x01 << (bit & 0x07));
     }
   
-  else
-    {
-      rxBufferIndex = rxBufferLength = 0;
-      msgStatus |= MSGUSD;
-    }  
-    
-  return value;
+  historyHead = (historyHead + 1) % SAME_HISTORY_SIZE;
+  
+  if (historyFill < SAME_HISTORY_SIZE)
+    historyFill++;
 }
 //
-//  The SAME message is parsed here.
+//  Replaces the Non-Volatile Storage access functions, size bytes from address 0,
+//  and recovers the log from them.
 //
-void SI4707::sameParse(void)
+void SI4707::nvBackend(NvRead read, NvWrite write, uint16_t size)
 {
-  if (!(msgStatus & MSGAVL))                     //  If no message is Available, return
-    return;
-          
-  samePlusIndex = 0;
-  sameLocations = 0;
-  sameDuration = 0;
-  sameDay = 0;
-  sameTime = 0;
+  nvRead = read;
+  nvWrite = write;
+  nvSize = size;
+  logRecover();
+}
+//
+//  Returns the size of the Non-Volatile Storage.
+//
+uint16_t SI4707::nvLength(void)
+{
+  return nvSize ? nvSize : EEPROM.length();
+}
+//
+//  Finds the newest valid frame by scanning every log slot once.
+//  Returns the number of valid frames.  It reads the whole log area, so call it
+//  with interrupts enabled, after begin(), unless nvBackend() already has.
+//
+uint8_t SI4707::logRecover(void)
+{
+  uint8_t frame[LOG_FRAME_SIZE];
+  uint16_t sequence, newest = 0;
+  uint8_t i;
   
-  uint8_t i = 0;
-    
-  sameOriginatorName[0] = rxBuffer[i + 1];
-  sameOriginatorName[1] = rxBuffer[i + 2];
-  sameOriginatorName[2] = rxBuffer[i + 3];
-  sameOriginatorName[3] = 0x00;
+  logHead = logFill = 0;
+  logSequence = 0;
+  logQueueHead = logQueueFill = 0;
+  logSlots = 0;
   
-  sameEventName[0] = rxBuffer[i + 5];
-  sameEventName[1] = rxBuffer[i + 6];
-  sameEventName[2] = rxBuffer[i + 7];
-  sameEventName[3] = 0x00;
+  if (nvLength() > NV_LOG_START)                 //  Only the frames that fit, none on a small EEPROM.
+    logSlots = ((nvLength() - NV_LOG_START < NV_LOG_SIZE) ? nvLength() - NV_LOG_START : NV_LOG_SIZE) / LOG_FRAME_SIZE;
   
-  for (i = 0; i < sizeof(rxBuffer); i++)         //  Look for the Plus Sign.
+  for (i = 0; i < logSlots; i++)
     {
-      if (rxBuffer[i] == 0x2B)
-        samePlusIndex = i;                       //  Found it.
+      if (!logReadFrame(i, frame))
+        continue;
       
-      if (rxBuffer[i] >= 0x30 && rxBuffer[i] <= 0x39) //  If the value is ascii, strip off the upper bits.
-        rxBuffer[i] = rxBuffer[i] & 0x0F;
-    }  
-  
-  if (samePlusIndex == 0)                        //  No Plus Sign found.
-    return;
-  
-  for (i = 6; i < samePlusIndex; i++)            //  There are no sameLocationCodes past the samePlusIndex.   
-    {
-      if (rxBuffer[i] == 0x2D)  
+      sequence = frame[0] << 8 | frame[1];
+      
+      if (logFill == 0 || int16_t(sequence - newest) > 0)
         {
-          sameLocationCodes[sameLocations] = 0;  //  Clear out any remaining data.
-          sameLocationCodes[sameLocations] += rxBuffer[i + 1] * 100000UL;
-          sameLocationCodes[sameLocations] += rxBuffer[i + 2] *  10000UL;
-          sameLocationCodes[sameLocations] += rxBuffer[i + 3] *   1000UL;
-          sameLocationCodes[sameLocations] += rxBuffer[i + 4] *    100UL;
-          sameLocationCodes[sameLocations] += rxBuffer[i + 5] *     10UL;
-          sameLocationCodes[sameLocations] += rxBuffer[i + 6] *      1UL;
-          
-          if (sameLocations > SAME_LOCATION_CODES) //  SAME_LOCATION_CODES (31) is the maximum allowed.
-            return;
-          
-          else
-            sameLocations++;
+          newest = sequence;
+          logHead = (i + 1) % logSlots;
+          logSequence = sequence + 1;
         }
-    }  
+      
+      logFill++;
+    }
   
-  sameDuration += rxBuffer[samePlusIndex + 1] * 600;
-  sameDuration += rxBuffer[samePlusIndex + 2] *  60;
-  sameDuration += rxBuffer[samePlusIndex + 3] *  10;
-  sameDuration += rxBuffer[samePlusIndex + 4] *   1;
-
-  sameDay += rxBuffer[samePlusIndex + 6] * 100;
-  sameDay += rxBuffer[samePlusIndex + 7] *  10;
-  sameDay += rxBuffer[samePlusIndex + 8] *   1;
-
-  sameTime += rxBuffer[samePlusIndex +  9] * 1000;
-  sameTime += rxBuffer[samePlusIndex + 10] *  100;
-  sameTime += rxBuffer[samePlusIndex + 11] *   10;
-  sameTime += rxBuffer[samePlusIndex + 12] *    1;
+  return logFill;
+}
+//
+//  Queues a frame for logService() to write.  Safe to call while servicing
+//  interrupts, it never touches storage.  Returns 0 if the queue is full or
+//  there is no room for a log.
+//
+uint8_t SI4707::logAppend(uint8_t type, const void *payload, uint8_t length)
+{
+  if (!logSlots || logQueueFill >= LOG_QUEUE_SIZE || length > LOG_PAYLOAD_SIZE)
+    return 0;
+  
+  uint8_t *frame = logQueue[(logQueueHead + logQueueFill) % LOG_QUEUE_SIZE];
+  
+  memset(frame, 0, LOG_FRAME_SIZE);
+  frame[2] = type;
+  frame[3] = length;
+  memcpy(&frame[4], payload, length);
+  logQueueFill++;
+  
+  return 1;
+}
+//
+//  Queues a snapshot of the current signal quality.
+//
+void SI4707::logSignal(void)
+{
+  SignalRecord record;
   
-  for (i = 0; i < 8; i++)
+  record.received = millis();
+  record.channel = channel;
+  record.rssi = rssi;
+  record.snr = snr;
+  record.freqoff = freqoff;
+  record.rsqStatus = rsqStatus;
+  record.asqStatus = asqStatus;
+  
+  logAppend(LOG_SIGNAL, &record, sizeof(record));
+}
+//
+//  Writes one queued frame to the oldest log slot, so every slot wears evenly,
+//  or the channel history once the queue is empty.  Call from loop().
+//  Returns the number of frames still queued.
+//
+uint8_t SI4707::logService(void)
+{
+  uint16_t crc, address;
+  uint8_t i;
+  
+  if (!logQueueFill)
     {
-      if (rxBuffer[i + samePlusIndex + 14] == 0x2D || rxBuffer[i + samePlusIndex + 14] == 0x00)
-        {
-          sameCallSign[i] = 0x00;
-          break;
-        }  
+      if (channelDirty)
+        channelSave();
       
-      sameCallSign[i] = rxBuffer[i + samePlusIndex + 14];
+      return 0;
     }
   
-  msgStatus |= (MSGUSD | MSGPAR);                // Set the status to show the message was successfully Parsed.
+  uint8_t *frame = logQueue[logQueueHead];
+  
+  frame[0] = highByte(logSequence);
+  frame[1] = lowByte(logSequence);
+  crc = crc16(frame, LOG_FRAME_SIZE - 2);
+  frame[LOG_FRAME_SIZE - 2] = highByte(crc);
+  frame[LOG_FRAME_SIZE - 1] = lowByte(crc);
+  
+  address = NV_LOG_START + logHead * LOG_FRAME_SIZE;
+  
+  for (i = 0; i < LOG_FRAME_SIZE; i++)
+    nvWrite(address + i, frame[i]);
+  
+  logSequence++;
+  logHead = (logHead + 1) % logSlots;
+  
+  if (logFill < logSlots)
+    logFill++;
+  
+  logQueueHead = (logQueueHead + 1) % LOG_QUEUE_SIZE;
+  logQueueFill--;
+  
+  return logQueueFill;
 }
 //
-//  Flush the SAME receive data.
+//  Returns the number of frames in the log.
 //
-void SI4707::sameFlush(void)
+uint8_t SI4707::logCount(void)
+{
+  return logFill;
+}
+//
+//  Returns the number of frames the log can hold, 0 if the storage is too small for one.
+//
+uint8_t SI4707::logCapacity(void)
 {
-  //TIMER1_STOP();
+  return logSlots;
+}
+//
+//  Reads the n-th most recent frame, 0 being the newest.  Copies at most
+//  length bytes of its payload and returns the payload length, 0 if n is
+//  out of range or the frame is damaged.
+//
+uint8_t SI4707::logRead(uint8_t n, uint8_t *type, void *payload, uint8_t length)
+{
+  uint8_t frame[LOG_FRAME_SIZE];
   
-  getSameStatus(CLRBUF | INTACK);
+  if (n >= logFill)
+    return 0;
   
-  for (uint8_t i = 0; i < SAME_BUFFER_SIZE; i++)
-    {
-      rxBuffer[i] = 0x00;
-      rxConfidence[i] = 0x00;
-    }
-
-  msgStatus = 0x00;
-  sameHeaderCount = sameLength = 0;
-  rxBufferIndex = rxBufferLength = 0;
+  if (!logReadFrame((logHead + logSlots - 1 - n) % logSlots, frame))
+    return 0;
+  
+  *type = frame[2];
+  memcpy(payload, &frame[4], frame[3] < length ? frame[3] : length);
+  
+  return frame[3];
+}
+//
+//  Erases the log.
+//
+void SI4707::logErase(void)
+{
+  for (uint16_t i = 0; i < logSlots * LOG_FRAME_SIZE; i++)
+    nvWrite(NV_LOG_START + i, 0xFF);
+  
+  logRecover();
+}
+//
+//  Reads a log slot, returns 1 if its frame is valid.
+//
+uint8_t SI4707::logReadFrame(uint8_t slot, uint8_t *frame)
+{
+  uint16_t address = NV_LOG_START + slot * LOG_FRAME_SIZE;
+  uint8_t i;
+  
+  for (i = 0; i < LOG_FRAME_SIZE; i++)
+    frame[i] = nvRead(address + i);
+  
+  if (frame[3] > LOG_PAYLOAD_SIZE)
+    return 0;
+  
+  return (crc16(frame, LOG_FRAME_SIZE - 2) == (frame[LOG_FRAME_SIZE - 2] << 8 | frame[LOG_FRAME_SIZE - 1]));
 }
 //
 //  Fill SAME rxBuffer for testing purposes.
@@ -674,9 +2618,9 @@ void SI4707::sameFill(const String &s)
 //
 void SI4707::writeCommand(uint8_t command)
 {
-  Wire.beginTransmission(RADIO_ADDRESS);
-  Wire.write(command);
-  Wire.endTransmission();
+  waitClear();
+  
+  i2cWrite(&command, 1);
   delay(CMD_DELAY);
 }
 //
@@ -684,10 +2628,11 @@ void SI4707::writeCommand(uint8_t command)
 //
 void SI4707::writeByte(uint8_t command, uint8_t value)
 {
-  Wire.beginTransmission(RADIO_ADDRESS);
-  Wire.write(command);
-  Wire.write(value);
-  Wire.endTransmission();
+  waitClear();
+  
+  uint8_t args[2] = { command, value };
+  
+  i2cWrite(args, sizeof(args));
   delay(CMD_DELAY);
 }
 //
@@ -695,12 +2640,11 @@ void SI4707::writeByte(uint8_t command, uint8_t value)
 //
 void SI4707::writeWord(uint8_t command, uint16_t value)
 {
-  Wire.beginTransmission(RADIO_ADDRESS);
-  Wire.write(command);
-  Wire.write(0x00);
-  Wire.write(highByte(value));
-  Wire.write(lowByte(value));
-  Wire.endTransmission();
+  waitClear();
+  
+  uint8_t args[4] = { command, 0x00, highByte(value), lowByte(value) };
+  
+  i2cWrite(args, sizeof(args));
   delay(CMD_DELAY);
 }
 //
@@ -708,42 +2652,211 @@ void SI4707::writeWord(uint8_t command, uint16_t value)
 //
 void SI4707::writeAddress(uint8_t address, uint8_t mode)
 {
-  Wire.beginTransmission(RADIO_ADDRESS);
-  Wire.write(WB_SAME_STATUS);
-  Wire.write(mode);
-  Wire.write(address);
-  Wire.endTransmission();
+  waitClear();
+  
+  uint8_t args[3] = { WB_SAME_STATUS, mode, address };
+  
+  i2cWrite(args, sizeof(args));
   delay(CMD_DELAY * 4);                          //  A CLRBUF takes a fair amount of time!    
 }
 //
-//  Reads the current Status byte.
+//  Returns CTSINT if the Si4707 is ready for a command, without delaying.
+//  A failed read is not retried, the caller asks again.
+//
+uint8_t SI4707::clearToSend(void)
+{
+  uint8_t status;
+  
+  if (!i2cRead(&status, 1, 0))
+    return 0;
+  
+  return status & CTSINT;
+}
+//
+//  Waits for CTS after a command sent by tick(), at most PROP_DELAY msec.
+//
+void SI4707::waitClear(void)
+{
+  uint32_t start = millis();
+  
+  if (!queueSent)
+    return;
+  
+  while (stepCommand && !stepPoll())             //  Finish a status read tick() started.
+    delayMicroseconds(CTS_POLL);
+  
+  while (!clearToSend() && millis() - start < PROP_DELAY)
+    delayMicroseconds(CTS_POLL);
+  
+  queueSent = 0;
+}
+//
+//  Reads the current Status byte, returns 0 if it could not be read.
 //
-void SI4707::readStatus(void)
+uint8_t SI4707::readStatus(uint8_t &status)
 {
-  Wire.requestFrom(RADIO_ADDRESS, 1);
+  uint8_t ok;
+  
   delay(CMD_DELAY);
-  if(Wire.available() > 0)
-    response[0] = Wire.read();
+  ok = i2cRead(&status, 1);
   delay(CMD_DELAY);  
+  
+  return ok;
 }
 //
-//  Reads the number of bytes specified by quantity.
+//  Sends a command and reads its response as soon as CTS is set, rather than
+//  after the fixed delays of readBurst().  Returns 0 if the response could not
+//  be read within PROP_DELAY msec, or if it has ERRINT set.
 //
-void SI4707::readBurst(int quantity)
+uint8_t SI4707::query(const uint8_t *args, uint8_t length, uint8_t *data, uint8_t quantity)
 {
-  uint8_t i = 0x00;
+  uint32_t start;
   
-  Wire.requestFrom(RADIO_ADDRESS, quantity);
-  delay(CMD_DELAY);
+  waitClear();
+  start = millis();                              //  PROP_DELAY is for this command, not the one before it.
   
-  while(Wire.available() > 0)
+  if (!i2cWrite(args, length))
+    return 0;
+  
+  do
     {
-      response[i] =  Wire.read(); 
-      i++;
+      delayMicroseconds(CTS_POLL);
+      
+      if (!i2cRead(data, quantity))
+        return 0;
+      
+      if (data[0] & CTSINT)
+        {
+          intStatus = data[0] | (intStatus & INTAVL);  //  The interrupt handler may have set it meanwhile.
+          return !(data[0] & ERRINT);            //  The Si4707 rejected the command, the response is not valid.
+        }
     }
+  while (millis() - start < PROP_DELAY);
+  
+  return 0;
+}
+//
+//  Reads the number of bytes specified by quantity into data, returns 0 and
+//  leaves intStatus alone if they could not be read.
+//
+uint8_t SI4707::readBurst(uint8_t *data, uint8_t quantity)
+{
+  uint8_t ok;
+  
+  delay(CMD_DELAY);
+  ok = i2cRead(data, quantity);
+  
+  if (ok)
+    intStatus = data[0] | (intStatus & INTAVL);  //  The interrupt handler may have set it meanwhile.
   
-  intStatus = response[0];
   delay(CMD_DELAY);
+  
+  return ok;
+}
+//
+//  Writes a transaction, retrying with backoff and recovering the bus if it keeps failing.
+//  With retries 0 it is tried once, without delaying.
+//
+uint8_t SI4707::i2cWrite(const uint8_t *data, uint8_t length, uint8_t retries)
+{
+  uint8_t i, attempt;
+  
+  for (attempt = 0; attempt <= retries; attempt++)
+    {
+      if (attempt)
+        i2cBackoff(attempt);
+      
+      Wire.beginTransmission(RADIO_ADDRESS);
+      
+      for (i = 0; i < length; i++)
+        Wire.write(data[i]);
+      
+      if (Wire.endTransmission() == 0)
+        return 1;
+    }
+  
+  if (retries)
+    i2cErrors++;
+  else
+    i2cMisses++;
+  
+  return 0;
+}
+//
+//  Reads a transaction, retrying with backoff and recovering the bus if it keeps failing.
+//  A short read, or a status byte with reserved bits set (a floating bus), is a failure.
+//
+uint8_t SI4707::i2cRead(uint8_t *data, uint8_t quantity, uint8_t retries)
+{
+  uint8_t i, attempt;
+  
+  for (attempt = 0; attempt <= retries; attempt++)
+    {
+      if (attempt)
+        i2cBackoff(attempt);
+      
+      if (Wire.requestFrom(RADIO_ADDRESS, quantity) != quantity)
+        continue;
+      
+      for (i = 0; i < quantity && Wire.available() > 0; i++)
+        data[i] = Wire.read();
+      
+      if (i == quantity && !(data[0] & STATUS_RESERVED))
+        return 1;
+    }
+  
+  if (retries)
+    i2cErrors++;
+  else
+    i2cMisses++;
+  
+  return 0;
+}
+//
+//  Waits before a retry, 1, 2, 4 ... msec, and recovers the bus before the last one.
+//
+void SI4707::i2cBackoff(uint8_t attempt)
+{
+  i2cRetries++;
+  
+  if (attempt == I2C_RETRIES)
+    {
+      busRecover();
+      return;
+    }
+  
+  delay(1 << (attempt - 1));
+}
+//
+//  Frees a slave holding SDA low by clocking SCL, then issues a STOP and restarts Wire.
+//
+void SI4707::busRecover(void)
+{
+  uint8_t i;
+  
+  Wire.end();
+  
+  pinMode(SDA_PIN, INPUT_PULLUP);
+  pinMode(SCL_PIN, OUTPUT);
+  
+  for (i = 0; i < 9 && digitalRead(SDA_PIN) == LOW; i++)
+    {
+      digitalWrite(SCL_PIN, LOW);
+      delayMicroseconds(5);
+      digitalWrite(SCL_PIN, HIGH);
+      delayMicroseconds(5);
+    }
+  
+  pinMode(SDA_PIN, OUTPUT);                      //  STOP, SDA rising while SCL is high.
+  digitalWrite(SDA_PIN, LOW);
+  delayMicroseconds(5);
+  digitalWrite(SCL_PIN, HIGH);
+  delayMicroseconds(5);
+  digitalWrite(SDA_PIN, HIGH);
+  delayMicroseconds(5);
+  
+  Wire.begin();
+  i2cRecoveries++;
 }
 //
 //
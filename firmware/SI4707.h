@@ -21,6 +21,7 @@
 #define SI4707_h
 //
 #include "application.h"
+#include "SI4707Frame.h"
 //
 //
 #define lowByte(w) ((uint8_t) ((w) & 0xff)) //from Arduino.h
@@ -30,6 +31,7 @@
 #define WB_CHANNEL_SPACING	           0x0A	     //  25 kHz.
 #define WB_MIN_FREQUENCY	           0xFDC0	     //  162.400 mHz.
 #define WB_MAX_FREQUENCY	           0xFDFC	     //  162.550 mHz.
+#define WB_CHANNELS                       7      //  Number of channels from WB_MIN_FREQUENCY to WB_MAX_FREQUENCY.
 //
 //  Si4707 Command definitions.
 //
@@ -88,6 +90,7 @@
 #define RSQINT                         0x08      //  Received Signal Quality Interrupt.
 #define ERRINT                         0x40      //  Error Interrupt.
 #define CTSINT                         0x80      //  Clear To Send Interrupt.
+#define STATUS_RESERVED                0x30      //  Always 0 in a status byte read from the Si4707.
 //
 //  Si4707 Status Register Masks.
 //
@@ -108,6 +111,8 @@
 #define ALERTOF                        0x02      //  Alert Tone has not been detected off since last WB_TUNE_FREQ.
 #define ALERT                          0x01      //  Alert Tone is currently present.
 //
+#define AGCDIS                         0x01      //  AGC is disabled, the gain is held where it was.
+//
 //  Si4707 Interrupt Acknowledge Commands.
 //
 #define CHECK                          0x00      //  Allows checking of status without clearing interrupt.
@@ -170,14 +175,62 @@
 
 #define INT                               2      //  Arduino Interrupt input pin.
 #define RST                               4      //  Arduino pin used to reset the Si4707.
+#define SDA_PIN                           0      //  Spark Core D0, I2C data, only driven directly during bus recovery.
+#define SCL_PIN                           1      //  Spark Core D1, I2C clock, only driven directly during bus recovery.
 #define ON 		                         0x01      //  Used for Power/Mute On.
 #define OFF 	                         0x00      //  Used for Power/Mute Off.
+#define STANDBY                        0x02      //  Used for Power Standby (powered, patched and tuned, but muted).
+#define STANDBY_IEN       (SAMEIEN | ASQIEN)     //  Interrupt sources kept during Standby.
+#define PROPERTY_CACHE                   16      //  Number of property values remembered for restore().
+#define DIAG_PROPERTIES                  15      //  Properties read into a Diagnostics snapshot.
+#define CTS_POLL                        100      //  Time between reads while a query waits for CTS (usec).
 #define CMD_DELAY	                        2      //  Inter-Command delay (301 usec).
 #define PROP_DELAY                       10      //  Set Property Delay (10.001 msec)
 #define PUP_DELAY	                      200      //  Power Up Delay.  (110.001 msec)
 #define TUNE_DELAY                      250      //  Tune Delay. (250.001 msec)
 #define RADIO_ADDRESS                  0x11      //  I2C address of the Si4707, shifted one bit.
 #define RADIO_VOLUME                 0x003F      //  Default Volume.
+#define I2C_RETRIES                       3      //  Retries of a failed transaction, the last one after a bus recovery.
+//
+//  Adaptive RSQ Definitions.
+//
+#define RSQ_WINDOW_MIN                    3      //  Narrowest half-width of the RSSI/SNR threshold window (dB).
+#define RSQ_WINDOW_MAX                   12      //  Widest half-width before RSQ interrupts are held off.
+#define RSQ_MIN_INTERVAL               1000      //  RSQ interrupts closer than this (msec) widen the window.
+#define RSQ_HOLD_OFF                  10000      //  Time RSQ interrupts stay disabled after a storm (msec).
+//
+//  Command Queue Definitions.
+//
+#define QUEUE_SIZE                        8      //  Number of commands waiting for tick().
+#define QUEUE_ARGS                        6      //  Longest queued command, SET_PROPERTY.
+//
+#define QUEUE_HIGH                     0x00      //  Queued command priorities.
+#define QUEUE_NORMAL                   0x01
+#define QUEUE_LOW                      0x02
+//
+#define STEP_NONE                      0xFF      //  No SAME chunk left for tick() to read.
+#define STEP_RSQ_CHECK                 0x01      //  An RSQ Status CHECK is wanted from tick().
+#define STEP_SAME_FLUSH                0x02      //  sameFlush() wants the SAME buffer cleared by tick().
+//
+//  Channel History Definitions.
+//
+#define CHANNEL_MIN_RSSI                 20      //  A stored channel must reach this RSSI (dBuV) to be kept,
+#define CHANNEL_MIN_SNR                  10      //  and this SNR (dB).
+#define CHANNEL_VERIFY_TIME            2000      //  Time after tuneBest() before the channel is verified (msec).
+//
+//  Front End Definitions.
+//
+#define FRONT_AGC_FREEZE               0x01      //  Policy:  hold the AGC gain from a SAME Preamble to the end of the Headers.
+#define FRONT_AFC_RETUNE               0x02      //  Policy:  retune to restart the AFC when it stays on its rail.
+#define FRONT_RELOCKED                 0x01      //  frontService():  the signal came back, see relockTime.
+#define FRONT_DECODED                  0x02      //  frontService():  the first clean Header since, see decodeTime.
+#define FRONT_LOCKED                   0x00      //  Front end states.
+#define FRONT_LOST                     0x01
+#define FRONT_WAITING                  0x02      //  Relocked, waiting for a Header.
+#define FRONT_FREEZE_MAX               8000      //  Longest AGC hold, three Headers take about 6 seconds (msec).
+#define FRONT_POLL                      250      //  RSQ poll interval while the signal is lost, railed or unreported (msec).
+#define FRONT_RAIL_COUNT                  4      //  Polls on the AFC rail before a retune.
+#define FRONT_DECODE_WINDOW           60000      //  A Header this long after a relock still counts for decodeTime (msec).
 //
 //  SAME Definitions.  
 //
@@ -186,6 +239,72 @@
 #define SAME_MIN_LENGTH                  36      //  The SAME message minimum acceptable length.
 #define SAME_LOCATION_CODES              30      //  Subtract 1, because we count from 0.
 #define SAME_TIME_OUT                     6      //  Time before buffers are flushed.
+#define SAME_DEDUP_SIZE                   8      //  Number of recent alerts remembered for duplicate suppression.
+#define SAME_DEDUP_MIN                    1      //  Minimum time in minutes an alert is remembered.
+#define SAME_HISTORY_SIZE                16      //  Number of alerts kept in the history ring.
+#define SAME_HISTORY_LOCATIONS            8      //  Location codes kept per history record.
+//
+//  Non-Volatile Storage Layout and Alert Log Definitions.  The channel history
+//  comes first, the log takes as many frames of NV_LOG_SIZE as the rest of the
+//  storage holds, see SI4707::logCapacity().
+//
+#define NV_CHANNEL_START             0x0000      //  Per-channel signal history, WB_CHANNELS ChannelRecords and a CRC.
+#define NV_CHANNEL_SIZE  (WB_CHANNELS * 8 + 2)
+//
+#define NV_LOG_START (NV_CHANNEL_START + NV_CHANNEL_SIZE)  //  First byte of the alert log.
+#ifndef NV_LOG_SIZE
+#define NV_LOG_SIZE                    1008      //  Most bytes given to the alert log, a multiple of LOG_FRAME_SIZE.
+#endif
+//
+#define LOG_FRAME_SIZE                   56      //  Sequence (2), type (1), length (1), payload, CRC (2).
+#define LOG_PAYLOAD_SIZE (LOG_FRAME_SIZE - 6)
+#define LOG_SLOTS (NV_LOG_SIZE / LOG_FRAME_SIZE)
+#define LOG_QUEUE_SIZE                    4      //  Frames waiting to be written by logService().
+//
+#define LOG_ALERT                      0x01      //  Payload is a SameRecord.
+#define LOG_SIGNAL                     0x02      //  Payload is a SignalRecord.
+//
+//  SAME Originator Codes, as stored in a SameRecord.
+//
+#define ORG_UNKNOWN                    0x00
+#define ORG_EAS                        0x01      //  Broadcast station or cable system.
+#define ORG_CIV                        0x02      //  Civil authorities.
+#define ORG_WXR                        0x03      //  National Weather Service.
+#define ORG_PEP                        0x04      //  Primary Entry Point System.
+//
+//  SAME Message States.
+//
+#define SAME_IDLE                      0x00      //  Waiting for a Preamble or Header.
+#define SAME_PREAMBLE                  0x01      //  Preamble detected, waiting for the first Header.
+#define SAME_HEADER                    0x02      //  One or more Headers received, more may follow.
+#define SAME_COMPLETE                  0x03      //  Header burst is over (third Header or Alert Tone).
+#define SAME_EOM                       0x04      //  End Of Message detected.
+//
+//  Alert Rule Definitions.
+//
+#define RULE_MAX                         16      //  Maximum number of loaded rules.
+//
+#define RULE_HEADER                    0x00      //  Trigger on a parsed SAME Header.
+#define RULE_ALERTON                   0x01      //  Trigger on the Alert Tone turning on.
+#define RULE_ALERTOF                   0x02      //  Trigger on the Alert Tone turning off.
+#define RULE_EOM                       0x03      //  Trigger on End Of Message.
+#define RULE_TRIGGERS                     4      //  Number of Rule Triggers.
+//
+#define RULE_MUTE                      0x01      //  Mute, value is ON or OFF.  Actions are queued for tick().
+#define RULE_VOLUME                    0x02      //  Volume, value is 0 to 63.
+#define RULE_GPO_HIGH                  0x03      //  Drive the GPOxLEVEL bits in value high.
+#define RULE_GPO_LOW                   0x04      //  Drive the GPOxLEVEL bits in value low.
+//
+#if SAME_CONFIDENCE_THRESHOLD < 1 || SAME_CONFIDENCE_THRESHOLD > 3
+#error "SAME_CONFIDENCE_THRESHOLD must be 1, 2 or 3."
+#endif
+//
+//  Radio Profile Script Opcodes.
+//
+#define SCRIPT_END                     0x00      //  End of the script.
+#define SCRIPT_POWER                   0x01      //  Power up, followed by 1 to upload the patch.
+#define SCRIPT_PROPERTY                0x02      //  Set a property, followed by the property and value words.
+#define SCRIPT_TUNE                    0x03      //  Tune, followed by the channel word, 0 to leave it to the caller.
 //
 //  Program Control Status Bits.
 //
@@ -195,6 +314,7 @@
 #define MSGPAR                         0x02      //  The SAME message was successfully Parsed.
 #define MSGUSD                         0x04      //  When set, this SAME message has been used. 
 #define MSGPUR                         0x08      //  The SAME message should be Purged (Third Header received). 
+#define MSGDUP                         0x10      //  The SAME message repeats an alert that has not yet expired.
 //
 //  Global Status Bytes.
 //
@@ -204,6 +324,7 @@ extern uint8_t sameStatus;
 extern uint8_t asqStatus;
 extern uint8_t agcStatus;
 extern uint8_t msgStatus;
+extern uint8_t statusRead;
 //
 //  Global Radio Variables.
 //
@@ -215,6 +336,18 @@ extern uint8_t rssi;
 extern uint8_t snr;
 extern int freqoff;
 extern uint8_t power;
+extern uint32_t resumeTime;
+extern uint32_t restoreTime;
+extern uint8_t rsqValid;
+extern uint32_t relockTime;
+extern uint32_t decodeTime;
+//
+//  Global I2C Health Counters.
+//
+extern uint16_t i2cErrors;
+extern uint16_t i2cRetries;
+extern uint16_t i2cRecoveries;
+extern uint16_t i2cMisses;
 //
 //  Global SAME Variables.
 //
@@ -232,10 +365,182 @@ extern uint16_t sameDuration;
 extern uint16_t sameDay;
 extern uint16_t sameTime;
 extern uint8_t sameWat;
+extern uint8_t sameMessageState;
+extern uint32_t sameTimer;
+extern uint32_t sameHash;
 //
-extern uint8_t response[];
 extern volatile uint8_t sreg;
-extern volatile uint8_t timer;
+//
+//  Decoded Si4707 responses.
+//
+struct TuneStatus
+{
+  uint8_t status;                                //  Interrupt status byte.
+  uint8_t valid;                                 //  VALID and AFCRL.
+  uint16_t channel;
+  uint8_t rssi;
+  uint8_t snr;
+};
+//
+struct RsqStatus
+{
+  uint8_t status;                                //  Interrupt status byte.
+  uint8_t interrupts;                            //  RSSILINT, RSSIHINT, SNRLINT and SNRHINT.
+  uint8_t valid;                                 //  VALID and AFCRL.
+  uint8_t rssi;
+  uint8_t snr;
+  int8_t freqoff;
+};
+//
+struct AsqStatus
+{
+  uint8_t status;                                //  Interrupt status byte.
+  uint8_t interrupts;                            //  ALERTON and ALERTOF.
+  uint8_t alert;                                 //  ALERT, the tone is present now.
+};
+//
+struct Revision
+{
+  uint8_t partNumber;                            //  Final two digits, 7 for an Si4707.
+  uint8_t firmwareMajor;
+  uint8_t firmwareMinor;
+  uint16_t patchId;
+  uint8_t componentMajor;
+  uint8_t componentMinor;
+  uint8_t chipRevision;
+};
+//
+//  A snapshot of the Si4707 for health checks, filled by SI4707::getDiagnostics().
+//
+struct Diagnostics
+{
+  Revision revision;
+  uint8_t revisionRead;                          //  1 if revision is valid.
+  uint8_t properties;                            //  Number read, DIAG_PROPERTIES unless the bus failed.
+  uint16_t propertyId[DIAG_PROPERTIES];
+  uint16_t propertyValue[DIAG_PROPERTIES];
+};
+//
+//  A radio configuration, checked and turned into a script at compile time by RADIO_PROFILE().
+//
+struct RadioProfile
+{
+  uint8_t patch;                                 //  1 to upload the 1050 Hz patch.
+  uint16_t interrupts;                           //  GPO_IEN.
+  uint16_t sameSources;                          //  WB_SAME_INTERRUPT_SOURCE.
+  uint16_t asqSources;                           //  WB_ASQ_INT_SOURCE.
+  uint16_t rsqSources;                           //  WB_RSQ_INT_SOURCE.
+  uint8_t snrHigh;                               //  RSQ thresholds.
+  uint8_t snrLow;
+  uint8_t rssiHigh;
+  uint8_t rssiLow;
+  uint8_t validSnr;                              //  WB_VALID_SNR_THRESHOLD.
+  uint8_t validRssi;                             //  WB_VALID_RSSI_THRESHOLD.
+  uint8_t volume;
+  uint8_t mute;                                  //  ON or OFF.
+  uint32_t frequency;                            //  kHz, 6 digits, or 0 to tune later.
+};
+//
+#define SCRIPT_WORD(w) highByte(w), lowByte(w)
+#define SCRIPT_SET(property, value) SCRIPT_PROPERTY, SCRIPT_WORD(property), SCRIPT_WORD(value)
+//
+//  Defines name[], the boot script for a constexpr RadioProfile, for SI4707::execute().
+//
+#define RADIO_PROFILE(name, p) \
+  static_assert(p.patch <= 1, "RadioProfile patch must be 0 or 1."); \
+  static_assert(!(p.interrupts & ~(STCIEN | ASQIEN | SAMEIEN | RSQIEN | ERRIEN | CTSIEN | STCREP | ASQREP | SAMEREP | RSQREP)), \
+                "RadioProfile interrupts has bits that are not GPO_IEN sources."); \
+  static_assert(!(p.sameSources & ~(HDRRDYIEN | PREDETIEN | SOMDETIEN | EOMDETIEN)), "RadioProfile sameSources is not valid."); \
+  static_assert(!(p.asqSources & ~(ALERTONIEN | ALERTOFIEN)), "RadioProfile asqSources is not valid."); \
+  static_assert(!(p.rsqSources & ~(RSSILIEN | RSSIHIEN | SNRLIEN | SNRHIEN)), "RadioProfile rsqSources is not valid."); \
+  static_assert(p.snrHigh <= 127 && p.snrLow <= p.snrHigh, "RadioProfile SNR thresholds must be 0 to 127, low <= high."); \
+  static_assert(p.rssiHigh <= 127 && p.rssiLow <= p.rssiHigh, "RadioProfile RSSI thresholds must be 0 to 127, low <= high."); \
+  static_assert(p.validSnr <= 127 && p.validRssi <= 127, "RadioProfile valid thresholds must be 0 to 127."); \
+  static_assert(p.volume <= 0x3F, "RadioProfile volume must be 0 to 63."); \
+  static_assert(p.mute == ON || p.mute == OFF, "RadioProfile mute must be ON or OFF."); \
+  static_assert(p.frequency == 0 || (p.frequency >= 162400 && p.frequency <= 162550 && p.frequency % 25 == 0), \
+                "RadioProfile frequency must be 0 or a 162.400 to 162.550 MHz channel."); \
+  const uint8_t name[] = \
+  { \
+    SCRIPT_POWER, p.patch, \
+    SCRIPT_SET(GPO_IEN, p.interrupts), \
+    SCRIPT_SET(WB_SAME_INTERRUPT_SOURCE, p.sameSources), \
+    SCRIPT_SET(WB_ASQ_INT_SOURCE, p.asqSources), \
+    SCRIPT_SET(WB_RSQ_SNR_HIGH_THRESHOLD, p.snrHigh), \
+    SCRIPT_SET(WB_RSQ_SNR_LOW_THRESHOLD, p.snrLow), \
+    SCRIPT_SET(WB_RSQ_RSSI_HIGH_THRESHOLD, p.rssiHigh), \
+    SCRIPT_SET(WB_RSQ_RSSI_LOW_THRESHOLD, p.rssiLow), \
+    SCRIPT_SET(WB_RSQ_INT_SOURCE, p.rsqSources), \
+    SCRIPT_SET(WB_VALID_SNR_THRESHOLD, p.validSnr), \
+    SCRIPT_SET(WB_VALID_RSSI_THRESHOLD, p.validRssi), \
+    SCRIPT_SET(RX_VOLUME, p.volume), \
+    SCRIPT_SET(RX_HARD_MUTE, p.mute ? 0x0003 : 0x0000), \
+    SCRIPT_TUNE, SCRIPT_WORD(p.frequency * 10 / 25), \
+    SCRIPT_END \
+  }
+//
+//  An Alert Rule.  A NULL event or originator, or a location of 0, matches anything.
+//  On the Alert Tone and EOM triggers, a rule with any of them set only matches
+//  when the Header of the current message was parsed.
+//
+struct SameRule
+{
+  uint8_t trigger;
+  const char *event;
+  const char *originator;
+  uint32_t location;
+  uint8_t action;
+  uint8_t value;
+};
+//
+//  A decoded alert as kept in the history ring.  Location codes are packed
+//  21 bits apiece (P 4, SS 7, CCC 10), use SI4707::historyLocation() to read them.
+//
+struct SameRecord
+{
+  uint32_t hash;                                 //  sameHash of the Header.
+  uint32_t received;                             //  millis() when it was parsed.
+  uint16_t issued;                               //  Minutes since 0000 UTC of the issue time (sameTime).
+  uint16_t day;                                  //  Julian day of issue (sameDay).
+  uint16_t duration;                             //  Purge time in minutes (sameDuration).
+  uint8_t event;                                 //  Index into the SAME event table, 0 if unknown.
+  uint8_t originator;                            //  ORG_xxx.
+  uint8_t locations;                             //  Number of location codes in the Header, only the first
+                                                 //  SAME_HISTORY_LOCATIONS are kept (see historyTruncated()).
+  uint8_t rssi;                                  //  Signal quality when parsed.
+  uint8_t snr;
+  char callSign[8];                              //  Not terminated when all 8 are used.
+  uint8_t locationCodes[(SAME_HISTORY_LOCATIONS * 21 + 7) / 8];
+} __attribute__((packed));
+//
+//  A signal quality snapshot as kept in the alert log.
+//
+struct SignalRecord
+{
+  uint32_t received;                             //  millis() when it was taken.
+  uint16_t channel;
+  uint8_t rssi;
+  uint8_t snr;
+  int8_t freqoff;
+  uint8_t rsqStatus;
+  uint8_t asqStatus;
+} __attribute__((packed));
+//
+//  What is remembered about each channel between power cycles.
+//
+struct ChannelRecord
+{
+  uint32_t sameTime;                             //  Time.now() of the last valid SAME Header, 0 if never.
+  uint8_t rssi;
+  uint8_t snr;
+  int8_t freqoff;
+  uint8_t reserved;
+} __attribute__((packed));
+//
+//  Non-Volatile Storage access, EEPROM unless replaced with SI4707::nvBackend().
+//
+typedef uint8_t (*NvRead)(uint16_t address);
+typedef void (*NvWrite)(uint16_t address, uint8_t value);
 //
 //  SI4707 Class.
 //
@@ -244,59 +549,284 @@ class SI4707
   public: 
 
     void begin(void);
-    void on(void);
-    void getRevision(void);
-    void patch(void);
+    uint8_t on(void);
+    uint8_t getRevision(Revision &revision);
+    uint8_t getDiagnostics(Diagnostics &diagnostics);
+    uint8_t patch(void);
 
     void off(void);
     void end(void);
     
+    uint8_t execute(const uint8_t *script);
+    
+    void standby(void);
+    void resume(void);
+    void restore(void);
+    
     void tune(uint32_t direct);
     void tune(void);
     void scan(void);
+    uint8_t tuneBest(void);
+    void channelService(void);
     
     uint8_t getIntStatus(void);
     void getTuneStatus(uint8_t mode);
+    uint8_t getTuneStatus(uint8_t mode, TuneStatus &status);
     void getRsqStatus(uint8_t mode);
+    uint8_t getRsqStatus(uint8_t mode, RsqStatus &status);
     void getSameStatus(uint8_t mode);
     void getAsqStatus(uint8_t mode);
+    uint8_t getAsqStatus(uint8_t mode, AsqStatus &status);
     void getAgcStatus(void);
+    
+    void rsqBegin(uint16_t sources);
+    uint8_t rsqService(void);
+    
+    void setAgcOverride(uint8_t value);
+    void setMaxTuneError(uint16_t value);
+    void frontBegin(uint8_t policy, uint16_t maxTuneError);
+    uint8_t frontService(void);
 
-    void setVolume(uint16_t volume);
-    void setMute(uint8_t value);
+    uint8_t setVolume(uint16_t volume);
+    uint8_t setMute(uint8_t value);
 
-    void setProperty(uint16_t property, uint16_t value);
+    uint8_t setProperty(uint16_t property, uint16_t value);
     uint16_t getProperty(uint16_t property);
+    uint8_t readProperties(const uint16_t *properties, uint16_t *values, uint8_t count);
 
     void gpioControl(uint8_t value);
-    void gpioSet(uint8_t value);
+    uint8_t gpioSet(uint8_t value);
+    
+    uint8_t queueCommand(const uint8_t *args, uint8_t length, uint8_t priority);
+    uint8_t queueProperty(uint16_t property, uint16_t value, uint8_t priority);
+    uint8_t queueGpioSet(uint8_t value, uint8_t priority);
+    uint8_t queueDone(uint8_t handle);
+    uint8_t tick(void);
+    
+    uint16_t frameEncode(uint8_t type, uint8_t *buffer, uint16_t size);
+    uint16_t jsonEncode(uint8_t type, char *buffer, uint16_t size);
       
     int  sameAvailable(void);
     char sameRead(void);
     void sameParse(void);
     void sameFlush(void);
     void sameFill(const String &s);
+    void sameService(void);
+    
+    uint8_t ruleLoad(const SameRule *rules, uint8_t count);
+    void ruleClear(void);
+    
+    void dedupClear(void);
+    
+    uint8_t historyCount(void);
+    const SameRecord *historyGet(uint8_t n);
+    uint8_t historyActive(uint32_t location, const SameRecord **list, uint8_t max);
+    uint32_t historyLocation(const SameRecord *record, uint8_t n);
+    uint8_t historyTruncated(const SameRecord *record);
+    void historyClear(void);
+    const char *sameEventCode(uint8_t event);
+    
+    void nvBackend(NvRead read, NvWrite write, uint16_t size);
+    uint8_t logRecover(void);
+    uint8_t logCapacity(void);
+    uint8_t logAppend(uint8_t type, const void *payload, uint8_t length);
+    void logSignal(void);
+    uint8_t logService(void);
+    uint8_t logCount(void);
+    uint8_t logRead(uint8_t n, uint8_t *type, void *payload, uint8_t length);
+    void logErase(void);
   
   private:
 
-    static uint8_t sameConf[];
-    static char sameData[];
     static uint8_t rxConfidence[];
     static char rxBuffer[];  
     static uint8_t rxBufferIndex;
     static uint8_t rxBufferLength;
     
+    struct RuleEntry
+    {
+      uint32_t event;
+      uint32_t originator;
+      uint32_t location;
+      uint8_t action;
+      uint8_t value;
+    };
+    
+    static RuleEntry ruleTable[];
+    static uint16_t ruleIndex[];
+    static uint8_t ruleCount;
+    static uint8_t ruleAsq;
+    static uint8_t eomHeard;
+    static uint8_t headerCurrent;
+    static uint32_t eomTimer;
+    static uint8_t gpoLevel;
+    
+    void ruleEvaluate(uint8_t trigger);
+    
+    static uint32_t dedupHash[];
+    static uint32_t dedupStamp[];
+    static uint32_t dedupLife[];
+    
+    uint8_t dedupCheck(void);
+    
+    static SameRecord historyRing[];
+    static uint8_t historyHead;
+    static uint8_t historyFill;
+    
+    void historyAdd(void);
+    
+    static NvRead nvRead;
+    static NvWrite nvWrite;
+    static uint16_t nvSize;
+    static uint8_t logQueue[][LOG_FRAME_SIZE];
+    static uint8_t logQueueHead;
+    static uint8_t logQueueFill;
+    static uint8_t logHead;
+    static uint8_t logFill;
+    static uint8_t logSlots;
+    static uint16_t logSequence;
+    
+    uint8_t logReadFrame(uint8_t slot, uint8_t *frame);
+    uint16_t nvLength(void);
+    
+    static uint16_t rsqSources;
+    static uint16_t rsqRssiAverage;
+    static uint16_t rsqSnrAverage;
+    static uint8_t rsqWindow;
+    static uint8_t rsqHold;
+    static uint8_t rsqPending;
+    static uint32_t rsqTimer;
+    static uint8_t rsqThreshold[];
+    
+    void rsqThresholds(void);
+    
+    static uint8_t frontPolicy;
+    static uint8_t frontState;
+    static uint8_t frontBurst;
+    static uint8_t frontRail;
+    static uint8_t frontEvents;
+    static uint8_t frontPoll;
+    static uint8_t frontAgcQueued;
+    static uint32_t frontFrozen;
+    static uint32_t frontTimer;
+    static uint32_t frontPolled;
+    static uint32_t frontRelocked;
+    
+    void frontDecoded(void);
+    void frontAgc(uint8_t value);
+    
+    static uint16_t propertyId[];
+    static uint16_t propertyValue[];
+    static uint8_t propertyCount;
+    static uint8_t patched;
+    
+    uint16_t propertyCached(uint16_t property, uint16_t value);
+    uint8_t propertyRemember(uint16_t property, uint16_t value);
+    
+    struct QueueEntry
+    {
+      uint8_t handle;                            //  0 when the entry is free.
+      uint8_t priority;
+      uint8_t length;
+      uint8_t args[QUEUE_ARGS];
+    };
+    
+    static QueueEntry queue[];
+    static uint8_t queueHandle;
+    static uint8_t queueFill;
+    static uint8_t queueSent;
+    
+    uint8_t clearToSend(void);
+    void waitClear(void);
+    
+    static ChannelRecord channelTable[];
+    static uint8_t channelDirty;
+    static uint8_t channelVerify;
+    static uint32_t channelTimer;
+    
+    ChannelRecord &channelRecord(void);
+    uint8_t channelLoad(void);
+    void channelSave(void);
+    void channelSame(void);
+    
     void writeCommand(uint8_t command);
     void writeByte(uint8_t command, uint8_t value);
     void writeWord(uint8_t command, uint16_t value);
     void writeAddress(uint8_t address, uint8_t mode);
     
-    void readStatus(void);
-    void readBurst(int quantity);
+    uint8_t writeProperty(uint16_t property, uint16_t value);
+    
+    //
+    //  A response of N bytes, reading past the end returns 0.
+    //
+    template <uint8_t N> struct Response
+    {
+      uint8_t raw[N];
+      
+      uint8_t operator[](uint8_t i) const { return i < N ? raw[i] : 0x00; }
+      uint16_t word(uint8_t i) const { return (*this)[i] << 8 | (*this)[i + 1]; }
+    };
+    
+    template <uint8_t N> uint8_t readResponse(Response<N> &r) { return readBurst(r.raw, N); }
+    
+    //
+    //  A WB_SAME_STATUS response read at an address, viewed as its eight SAME
+    //  bytes and their confidence, two bits per byte, byte 0 in the low bits of RESP5.
+    //
+    struct SameChunk : Response<14>
+    {
+      uint8_t text(uint8_t j) const { return (*this)[j + 6]; }
+      uint8_t confidence(uint8_t j) const { return (j < 4 ? (*this)[5] : (*this)[4]) >> ((j & 0x03) * 2) & 0x03; }
+    };
+    
+    uint8_t readStatus(uint8_t &status);
+    uint8_t readBurst(uint8_t *data, uint8_t quantity);
+    uint8_t query(const uint8_t *args, uint8_t length, uint8_t *data, uint8_t quantity);
+    uint8_t readSameChunk(uint8_t address);
+    
+    void statusDecode(const Response<6> &r, TuneStatus &status);
+    void statusDecode(const Response<8> &r, RsqStatus &status);
+    void statusDecode(const Response<3> &r, AsqStatus &status);
+    void statusApply(const TuneStatus &status);
+    void statusApply(const RsqStatus &status);
+    void statusApply(const AsqStatus &status);
+    uint8_t sameUpdate(const Response<4> &r, uint8_t mode);
+    void sameChunk(const SameChunk &chunk, uint8_t address);
+    void sameCheck(void);
+    
+    //
+    //  The response of the status read tick() has under way.
+    //
+    union StepResponse
+    {
+      Response<1> status;
+      Response<3> asq;
+      Response<4> same;
+      Response<6> tune;
+      Response<8> rsq;
+      SameChunk chunk;
+    };
+    
+    static StepResponse stepResponse;
+    static uint8_t stepCommand;                  //  0 when no read is under way.
+    static uint8_t stepMode;
+    static uint8_t stepAddress;
+    static uint8_t stepChunk;                    //  Next SAME chunk to read, STEP_NONE if none.
+    static uint8_t stepWanted;
+    static uint8_t stepDrop;                     //  Drop the response, sameFlush() came since.
+    static uint32_t stepTimer;
+    
+    uint8_t stepBusy(void);
+    void stepStart(void);
+    uint8_t stepPoll(void);
+    void stepDone(void);
+    
+    uint8_t i2cWrite(const uint8_t *data, uint8_t length, uint8_t retries = I2C_RETRIES);
+    uint8_t i2cRead(uint8_t *data, uint8_t quantity, uint8_t retries = I2C_RETRIES);
+    void i2cBackoff(uint8_t attempt);
+    void busRecover(void);
 };
 
 extern SI4707 Radio;
 
 #endif  //  End of SI4707.h
-
-#endif  //  End of SI4707.h
@@ -0,0 +1,148 @@
+/*
+  SI4707Frame.h - Binary alert frames sent by the SI4707 library, and their decoder.
+
+  Copyright 2013 by Ray H. Dees
+  Copyright 2013 by AIW Industries, LLC
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+  This file has no Spark dependencies, so a host collector can include it
+  on its own to decode the frames.
+
+  Frame:         Sync (0xA5), Type, Payload Length (2), Payload, CRC-16/CCITT (2) of Type through Payload.
+
+  FRAME_SIGNAL:  Channel (2), RSSI, SNR, FREQOFF, RSQ Status, ASQ Status.
+
+  FRAME_ALERT:   Originator (3), Event (3), Duration (2), Day (2), Time (2),
+                 Callsign Length, Callsign, Location Count, Location Codes (3 each),
+                 followed by the FRAME_SIGNAL payload.
+
+  Multi-byte values are big-endian.
+*/
+#ifndef SI4707Frame_h
+#define SI4707Frame_h
+//
+#include <stdint.h>
+#include <string.h>
+//
+#define FRAME_SYNC                     0xA5      //  First byte of every frame.
+#define FRAME_ALERT                    0x01      //  A parsed SAME Header and the signal quality.
+#define FRAME_SIGNAL                   0x02      //  Signal quality only.
+//
+#define FRAME_OVERHEAD                    6      //  Sync, Type, Length and CRC.
+#define FRAME_LOCATIONS                  31      //  Most location codes in a SAME Header.
+#define FRAME_MAX_SIZE (FRAME_OVERHEAD + 12 + 1 + 8 + 1 + FRAME_LOCATIONS * 3 + 7)
+//
+//  A decoded frame.
+//
+struct SameFrame
+{
+  uint8_t type;
+  char originator[4];
+  char event[4];
+  char callSign[9];
+  uint16_t duration;
+  uint16_t day;
+  uint16_t time;
+  uint8_t locations;
+  uint32_t locationCodes[FRAME_LOCATIONS];
+  uint16_t channel;
+  uint8_t rssi;
+  uint8_t snr;
+  int8_t freqoff;
+  uint8_t rsqStatus;
+  uint8_t asqStatus;
+};
+//
+//  Returns the CRC-16/CCITT of a block of bytes.
+//
+static inline uint16_t crc16(const uint8_t *data, uint16_t length)
+{
+  uint16_t crc = 0xFFFF;
+  uint8_t i;
+
+  while (length--)
+    {
+      crc ^= uint16_t(*data++) << 8;
+
+      for (i = 0; i < 8; i++)
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+
+  return crc;
+}
+//
+//  Decodes one frame from the start of data.  Returns the number of bytes it
+//  used, or 0 if data does not start with a complete, valid frame.
+//
+static inline uint16_t frameDecode(const uint8_t *data, uint16_t length, SameFrame *frame)
+{
+  uint16_t size, i = 4;
+  uint8_t j, n;
+
+  if (length < FRAME_OVERHEAD || data[0] != FRAME_SYNC)
+    return 0;
+
+  size = (data[2] << 8 | data[3]) + FRAME_OVERHEAD;
+
+  if (size > length || crc16(&data[1], size - 3) != (data[size - 2] << 8 | data[size - 1]))
+    return 0;
+
+  memset(frame, 0, sizeof(SameFrame));
+  frame->type = data[1];
+
+  if (frame->type == FRAME_ALERT)
+    {
+      memcpy(frame->originator, &data[i], 3);
+      memcpy(frame->event, &data[i + 3], 3);
+      frame->duration = data[i + 6] << 8 | data[i + 7];
+      frame->day = data[i + 8] << 8 | data[i + 9];
+      frame->time = data[i + 10] << 8 | data[i + 11];
+      i += 12;
+
+      n = data[i++];
+      if (n > 8 || i + n >= size - 2)
+        return 0;
+
+      memcpy(frame->callSign, &data[i], n);
+      i += n;
+
+      n = data[i++];
+      if (n > FRAME_LOCATIONS || i + n * 3 + 7 > size - 2)
+        return 0;
+
+      for (j = 0; j < n; j++, i += 3)
+        frame->locationCodes[j] = uint32_t(data[i]) << 16 | uint32_t(data[i + 1]) << 8 | data[i + 2];
+
+      frame->locations = n;
+    }
+
+  else if (frame->type != FRAME_SIGNAL)
+    return size;                                 //  Unknown, but intact, skip it.
+
+  if (i + 7 > size - 2)
+    return 0;
+
+  frame->channel = data[i] << 8 | data[i + 1];
+  frame->rssi = data[i + 2];
+  frame->snr = data[i + 3];
+  frame->freqoff = int8_t(data[i + 4]);
+  frame->rsqStatus = data[i + 5];
+  frame->asqStatus = data[i + 6];
+
+  return size;
+}
+
+#endif  //  End of SI4707Frame.h
@@ -12,9 +12,51 @@
 */
 #include "SI4707.h"
 //
+//  Function Prototypes, for compilers that don't add them (see linux/application.h).
+//
+void getStatus(void);
+void getFunction(void);
+void showMenu(void);
+void showRevision(const Revision &revision);
+void showDiagnostics(void);
+void printHex(byte value);
+void intSet(void);
+//
 //  Global Variables.
 //
 byte function = 0x00;           //  Function to be performed.
+char report[400];               //  A JSON alert or signal report.
+Diagnostics diagnostics;        //  Filled by 'r'.
+//
+//  Alert Rules, acted on by the driver as soon as the status is read.
+//  Set your own county code (PSSCCC) in place of 0 to limit a rule to it.
+//
+const SameRule rules[] =
+{
+  { RULE_ALERTON, NULL,  NULL, 0, RULE_MUTE,     OFF       },  //  Unmute on the Alert Tone.
+  { RULE_EOM,     NULL,  NULL, 0, RULE_MUTE,     ON        },  //  Mute on End Of Message.
+  { RULE_HEADER,  "TOR", NULL, 0, RULE_GPO_HIGH, GPO1LEVEL },  //  Raise GPO1 on a Tornado Warning.
+  { RULE_EOM,     NULL,  NULL, 0, RULE_GPO_LOW,  GPO1LEVEL },  //  Drop GPO1 on End Of Message.
+};
+//
+//  Radio Profile, checked when it is compiled and played back by execute() in setup().
+//  All useful interrupts are enabled here.
+//
+constexpr RadioProfile profile =
+{
+  1,                                                         //  Include the 1050 Hz patch, 0 if not using it.
+  CTSIEN | ERRIEN | RSQIEN | SAMEIEN | ASQIEN | STCIEN,     //  Interrupts.
+  EOMDETIEN | HDRRDYIEN | PREDETIEN,                         //  SAME Interrupt Sources, PREDETIEN for FRONT_AGC_FREEZE.
+  ALERTOFIEN | ALERTONIEN,                                   //  ASQ Interrupt Sources.
+  SNRHIEN | SNRLIEN | RSSIHIEN | RSSILIEN,                   //  RSQ Interrupt Sources.
+  127, 0, 127, 0,                                            //  SNR and RSSI High/Low thresholds, until rsqBegin().
+  3, 20,                                                     //  Valid SNR and RSSI thresholds.
+  RADIO_VOLUME,                                              //  Volume.
+  OFF,                                                       //  Mute.
+  0,                                                         //  No tune, tuneBest() picks the channel.
+};
+
+RADIO_PROFILE(boot, profile);
 //
 //  Setup Loop.
 //
@@ -40,38 +82,29 @@ void setup()
   noInterrupts();
   Radio.begin();
   interrupts();
+  Radio.logRecover();     //  Scans the whole EEPROM log, so not with interrupts off.
+  if (!Radio.logCapacity())
+    Serial.println(F("EEPROM too small, alerts will not be logged."));
   delay(10);
   Wire.begin();
   delay(10);
-  Radio.patch();          //  Use this one to to include the 1050 Hz patch.
-  //Radio.on();           //  Use this one if not using the patch.
-  Radio.getRevision();  //  Only captured on the logic analyzer - not displayed.
+  if (!Radio.execute(boot))  //  Powers up and sets the profile above, in a few msec.
+    Serial.println(F("The Si4707 did not power up, check the wiring."));
+  if (Radio.getRevision(diagnostics.revision))  //  The driver prints nothing, formatting is up to the sketch.
+    showRevision(diagnostics.revision);
   showMenu();
-//  
-//  All useful interrupts are enabled here.
-//
-  Radio.setProperty(GPO_IEN, (CTSIEN | ERRIEN | RSQIEN | SAMEIEN | ASQIEN | STCIEN));
-//  
-//  RSQ Interrupt Sources.
-//
-  //Radio.setProperty(WB_RSQ_SNR_HIGH_THRESHOLD, 0x007F);   // 127 dBuV for testing..want it high                                      
-  //Radio.setProperty(WB_RSQ_SNR_LOW_THRESHOLD, 0x0001);    // 1 dBuV for testing                                   
-  //Radio.setProperty(WB_RSQ_RSSI_HIGH_THRESHOLD, 0x004D);  // -30 dBm for testing                                     
-  //Radio.setProperty(WB_RSQ_RSSI_LOW_THRESHOLD, 0x0007);   // -100 dBm for testing                                      
-  //Radio.setProperty(WB_RSQ_INT_SOURCE, (SNRHIEN | SNRLIEN | RSSIHIEN | RSSILIEN));    
-//
-//  SAME Interrupt Sources.
-//
-  Radio.setProperty(WB_SAME_INTERRUPT_SOURCE, (EOMDETIEN | HDRRDYIEN));
 //
-//  ASQ Interrupt Sources.
+//  Alert Rules.
 //
-  Radio.setProperty(WB_ASQ_INT_SOURCE, (ALERTOFIEN | ALERTONIEN));
+  Radio.ruleLoad(rules, sizeof(rules) / sizeof(rules[0]));
 //
 //  Tune to the desired frequency.
 //
   delay(250);
-  Radio.tune(162550);  //  6 digits only.
+  Radio.tuneBest();       //  Best channel from the stored history, or a scan the first time.
+  //Radio.tune(162550);   //  Use this one for a fixed frequency, 6 digits only.
+  Radio.rsqBegin(profile.rsqSources);  //  The driver moves the RSQ thresholds with the signal.
+  Radio.frontBegin(FRONT_AGC_FREEZE | FRONT_AFC_RETUNE, 10);  //  Holds the AGC through SAME, AFC within 10 kHz.
   
   delay(250);
   digitalWrite(D7, LOW);
@@ -85,102 +118,81 @@ void setup()
 //
 void loop() // run over and over
 {
-  if (intStatus & INTAVL)
+  Radio.tick();            //  Reads the status an interrupt asks for, or sends one queued command, a step a pass.
+  
+  if (statusRead)
     getStatus();
+  
+  Radio.sameService();  //  Flushes the SAME buffers between messages and on a stalled Header.
+  Radio.logService();   //  Writes queued alerts to the log, one frame per pass.
+  Radio.channelService();  //  Checks the channel picked by tuneBest().
+  
+  if (Radio.rsqService())  //  Only meaningful RSSI/SNR changes, at a bounded rate.
+    {
+      Serial.write((uint8_t *) report, Radio.jsonEncode(FRAME_SIGNAL, report, sizeof(report)));
+      Radio.logSignal();
+    }
+  
+  if (Radio.frontService() & FRONT_RELOCKED)  //  After rsqService(), it reads what that left.
+    {
+      Serial.print(F("Relocked in "));
+      Serial.print(relockTime);
+      Serial.println(F(" msec."));
+    }
        
   if (Serial.available() > 0)
     getFunction();
 }
 //
-//  Status bits are processed here.
+//  Status bits are processed here, once tick() has read them.
 //
 void getStatus()
 {
-  Radio.getIntStatus();
+  uint8_t status = statusRead;
+  
+  statusRead = 0x00;
     
-  if (intStatus & STCINT)
+  if (status & STCINT)
     {
-      Radio.getTuneStatus(INTACK);  //  Using INTACK clears STCINT, CHECK preserves it.
       Serial.print(F("FREQ: "));
       Serial.print(frequency, 3);
       Serial.print(F("  RSSI: "));
       Serial.print(rssi);
       Serial.print(F("  SNR: "));
       Serial.println(snr);
-      Radio.sameFlush();             //  This should be done after any tune function.
       //intStatus |= RSQINT;         //  We can force it to get rsqStatus on any tune.
     }  
      
-  if (intStatus & RSQINT)  
+  if (status & SAMEINT && sameStatus & EOMDET)
     {
-      Radio.getRsqStatus(INTACK);
-      Serial.print(F("RSSI: "));
-      Serial.print(rssi);
-      Serial.print(F("  SNR: "));
-      Serial.print(snr);
-      Serial.print(F("  FREQOFF: "));
-      Serial.println(freqoff);
+      Serial.println(F("EOM detected."));
+      Serial.println();
+      //  More application specific code could go here. (Mute audio, turn something on/off, etc.)
     }  
   
-  if (intStatus & SAMEINT)
+  else if (status & SAMEINT)
     {
-      Radio.getSameStatus(INTACK);
-      
-      if (sameStatus & EOMDET)
-        {
-          Radio.sameFlush();
-          Serial.println(F("EOM detected."));
-          Serial.println();
-          //  More application specific code could go here. (Mute audio, turn something on/off, etc.)
-          return;
-        }  
-      
       if (msgStatus & MSGAVL && (!(msgStatus & MSGUSD)))  // If a message is available and not already used,
         Radio.sameParse();                                // parse it.
   
+      if (msgStatus & MSGDUP)
+        {
+           msgStatus &= ~MSGDUP;
+           Serial.println(F("Duplicate alert suppressed."));
+           Serial.println();
+        }
+  
       if (msgStatus & MSGPAR)
         {  
            msgStatus &= ~MSGPAR;                         // Clear the parse status, so that we don't print it again.
-           Serial.print(F("Originator: "));
-           Serial.println(sameOriginatorName);
-           Serial.print(F("Event: "));
-           Serial.println(sameEventName);
-           Serial.print(F("Locations: "));
-           Serial.println(sameLocations);
-           Serial.print(F("Location Codes: "));
-           
-           for (int i = 0; i < sameLocations; i++)
-             {
-                Serial.print(sameLocationCodes[i]);
-                Serial.print(' ');
-             }  
-       
-           Serial.println();
-           Serial.print(F("Duration: "));
-           Serial.println(sameDuration);
-           Serial.print(F("Day: "));
-           Serial.println(sameDay);
-           Serial.print(F("Time: "));
-           Serial.println(sameTime);
-           Serial.print(F("Callsign: "));
-           Serial.println(sameCallSign);
-           Serial.println();
+           Serial.write((uint8_t *) report, Radio.jsonEncode(FRAME_ALERT, report, sizeof(report)));
         }  
-  
-      if (msgStatus & MSGPUR)  //  Signals that the third header has been received.
-        Radio.sameFlush();
    }
     
-  if (intStatus & ASQINT)
+  if (status & ASQINT && sameWat != asqStatus)
     {
-      Radio.getAsqStatus(INTACK);
-    
-      if (sameWat == asqStatus)
-        return;
-
       if (asqStatus == 0x01)
         {
-          Radio.sameFlush();
           Serial.println(F("WAT is on."));
           Serial.println();
           //  More application specific code could go here.  (Unmute audio, turn something on/off, etc.)
@@ -196,9 +208,8 @@ void getStatus()
       sameWat = asqStatus;
     }  
   
-  if (intStatus & ERRINT)
+  if (status & ERRINT)
     {
-      intStatus &= ~ERRINT;
       Serial.println(F("An error occured!"));
       Serial.println();
     }
@@ -242,7 +253,7 @@ void getFunction()
                 if (volume <= 0x0000)
                   break;
                 volume--;
-                Radio.setVolume(volume);
+                Radio.queueProperty(RX_VOLUME, volume, QUEUE_NORMAL);  //  Sent by tick(), SAME comes first.
                 Serial.print(F("Volume: "));
                 Serial.println(volume);
                 break;
@@ -251,13 +262,13 @@ void getFunction()
                 if (volume >= 0x003F)
                   break;
                 volume++;
-                Radio.setVolume(volume);
+                Radio.queueProperty(RX_VOLUME, volume, QUEUE_NORMAL);  //  Sent by tick(), SAME comes first.
                 Serial.print(F("Volume: "));
                 Serial.println(volume, DEC);
                 break;
       
       case 'm':
-                if (mute)
+                if (mute)                //  Queued, sent by tick() as the volume is.
                   {
                     Radio.setMute(OFF);
                     Serial.println(F("Mute: Off"));
@@ -271,6 +282,35 @@ void getFunction()
                   }
       
       case 'o':
+                if (power == ON)
+                  {
+                    Radio.standby();
+                    Serial.println(F("Radio in standby."));
+                    break;
+                  }  
+                else if (power == STANDBY)
+                  {
+                    Radio.resume();
+                    Serial.print(F("Radio resumed in "));
+                    Serial.print(resumeTime);
+                    Serial.println(F(" usec."));
+                    break;
+                  }
+                else
+                  {
+                    Radio.restore();
+                    if (!power)
+                      {
+                        Serial.println(F("Radio did not power up."));
+                        break;
+                      }
+                    Serial.print(F("Radio restored in "));
+                    Serial.print(restoreTime);
+                    Serial.println(F(" usec."));
+                    break;
+                  }
+      
+      case 'p':
                 if (power)
                   {
                     Radio.off();
@@ -279,12 +319,46 @@ void getFunction()
                   }  
                 else
                   {
-                    Radio.on();
-                    Serial.println(F("Radio powered on."));
-                    Radio.tune();
+                    Radio.restore();
+                    if (!power)
+                      {
+                        Serial.println(F("Radio did not power up."));
+                        break;
+                      }
+                    Serial.print(F("Radio restored in "));
+                    Serial.print(restoreTime);
+                    Serial.println(F(" usec."));
                     break;
                   }
       
+      case 'e':
+                Serial.print(F("I2C Errors: "));
+                Serial.print(i2cErrors);
+                Serial.print(F("  Retries: "));
+                Serial.print(i2cRetries);
+                Serial.print(F("  Recoveries: "));
+                Serial.print(i2cRecoveries);
+                Serial.print(F("  Missed polls: "));
+                Serial.println(i2cMisses);
+                break;
+      
+      case 'r':
+                showDiagnostics();
+                break;
+      
+      case 'f':
+                Radio.getAgcStatus();
+                Serial.print(F("AGC: "));
+                Serial.print((agcStatus & AGCDIS) ? F("Held") : F("Auto"));
+                Serial.print(F("  AFC Rail: "));
+                Serial.print((rsqValid & AFCRL) ? F("Yes") : F("No"));
+                Serial.print(F("  Relock: "));
+                Serial.print(relockTime);
+                Serial.print(F(" msec  Decode: "));
+                Serial.print(decodeTime);
+                Serial.println(F(" msec"));
+                break;
+      
       default:
                 break;
     }
@@ -305,10 +379,60 @@ void showMenu()
   Serial.println(F("Volume - =          '-'"));
   Serial.println(F("Volume + =          '+'"));
   Serial.println(F("Mute / Unmute =     'm'"));
-  Serial.println(F("On / Off =          'o'"));
+  Serial.println(F("Standby / Resume =  'o'"));
+  Serial.println(F("Power Off / On =    'p'"));
+  Serial.println(F("I2C Health =        'e'"));
+  Serial.println(F("Front End =         'f'"));
+  Serial.println(F("Diagnostics =       'r'"));
   Serial.println();
 }  
 //
+//  Prints the revision of the Si4707.
+//
+void showRevision(const Revision &revision)
+{
+  Serial.print(F("Part Number: Si470"));
+  Serial.println(revision.partNumber);
+  Serial.print(F("Major Firmware Revision: 0x"));
+  Serial.println(revision.firmwareMajor, HEX);
+  Serial.print(F("Minor Firmware Revision: 0x"));
+  Serial.println(revision.firmwareMinor, HEX);
+  Serial.print(F("Patch ID: 0x"));
+  Serial.println(revision.patchId, HEX);
+  Serial.print(F("Component Firmware Major Revision: 0x"));
+  Serial.println(revision.componentMajor, HEX);
+  Serial.print(F("Component Firmware Minor Revision: 0x"));
+  Serial.println(revision.componentMinor, HEX);
+  Serial.print(F("Chip Revision: 0x"));
+  Serial.println(revision.chipRevision, HEX);
+  Serial.println();
+}
+//
+//  Prints the revision and the property snapshot.
+//
+void showDiagnostics()
+{
+  uint8_t i;
+  
+  Radio.getDiagnostics(diagnostics);
+  
+  if (diagnostics.revisionRead)
+    showRevision(diagnostics.revision);
+  else
+    Serial.println(F("Revision not read."));
+  
+  for (i = 0; i < diagnostics.properties; i++)
+    {
+      Serial.print(F("Property 0x"));
+      Serial.print(diagnostics.propertyId[i], HEX);
+      Serial.print(F(" = "));
+      Serial.println(diagnostics.propertyValue[i]);
+    }
+  
+  if (diagnostics.properties < DIAG_PROPERTIES)
+    Serial.println(F("Properties incomplete."));
+}
+//
 //  Simple Hex print utility - Prints a Byte with a leading zero and trailing space.
 //
 void printHex(byte value)
@@ -0,0 +1,229 @@
+/*
+  SI4707Bench.cpp - Throughput of the SI4707 library's alert serializers.
+
+  Copyright 2013 by Ray H. Dees
+  Copyright 2013 by AIW Industries, LLC
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+  Has SI4707Emulator put a Header on the air, lets the unmodified driver
+  parse it, then times frameEncode(), the host side frameDecode() and
+  jsonEncode() on the result.  Every decoded frame is checked against the
+  parse, and the JSON is printed once.
+
+    g++ -std=gnu++11 -O2 -Ifirmware/linux -Ifirmware firmware/linux/SI4707Bench.cpp \
+        firmware/linux/SI4707Emulator.cpp firmware/SI4707.cpp firmware/linux/application.cpp \
+        firmware/linux/SI4707Bus.cpp -pthread -o si4707-bench
+
+    si4707-bench [-n iterations] [-h header]
+
+  Exits 1 if the Header was not parsed or a frame did not decode back to it.
+*/
+#if defined(__linux__)
+
+#include "SI4707.h"
+#include "SI4707Bus.h"
+#include "SI4707Emulator.h"
+#include "SI4707Frame.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+//
+#define BENCH_ITERATIONS            1000000      //  Default passes of each serializer.
+#define BENCH_STEP                    10000      //  Virtual usec between passes while the Header is parsed.
+//
+static SI4707Emulator radio;
+static uint8_t nvMemory[EEPROM_SIZE];
+//
+//  Radio Profile, as the example sketch.
+//
+constexpr RadioProfile benchProfile =
+{
+  1,
+  CTSIEN | ERRIEN | RSQIEN | SAMEIEN | ASQIEN | STCIEN,
+  EOMDETIEN | HDRRDYIEN | PREDETIEN,
+  ALERTOFIEN | ALERTONIEN,
+  SNRHIEN | SNRLIEN | RSSIHIEN | RSSILIEN,
+  127, 0, 127, 0,
+  3, 20,
+  RADIO_VOLUME,
+  OFF,
+  162550,
+};
+
+RADIO_PROFILE(benchBoot, benchProfile);
+//
+static int benchTransfer(struct i2c_msg *msgs, uint32_t count)
+{
+  return radio.transfer(msgs, count);
+}
+
+static uint8_t benchNvRead(uint16_t address)
+{
+  return nvMemory[address % EEPROM_SIZE];
+}
+
+static void benchNvWrite(uint16_t address, uint8_t value)
+{
+  nvMemory[address % EEPROM_SIZE] = value;
+}
+
+static double benchSeconds(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+//
+//  Returns 1 if a decoded frame matches the last parse.
+//
+static uint8_t benchMatch(const SameFrame &frame)
+{
+  uint8_t i;
+
+  if (frame.type != FRAME_ALERT || strcmp(frame.originator, sameOriginatorName) || strcmp(frame.event, sameEventName) ||
+      strcmp(frame.callSign, sameCallSign) || frame.duration != sameDuration || frame.day != sameDay ||
+      frame.time != sameTime || frame.locations != sameLocations || frame.channel != channel)
+    return 0;
+
+  for (i = 0; i < frame.locations; i++)
+    if (frame.locationCodes[i] != sameLocationCodes[i])
+      return 0;
+
+  return 1;
+}
+//
+//  Plays the Header to the driver, as the example sketch services it.
+//  Returns 1 once it is parsed.
+//
+static uint8_t benchParse(const char *header)
+{
+  uint16_t i;
+
+  radio.samePreamble();
+  radio.sameHeader(header, 0);
+
+  for (i = 0; i < 1000 && !(msgStatus & MSGPAR); i++)
+    {
+      Radio.getIntStatus();
+
+      if (intStatus & SAMEINT)
+        {
+          Radio.getSameStatus(INTACK);
+
+          if (msgStatus & MSGAVL && (!(msgStatus & MSGUSD)))
+            Radio.sameParse();
+        }
+
+      Radio.sameService();
+      clockAdvance(BENCH_STEP);
+    }
+
+  return msgStatus & MSGPAR;
+}
+//
+int main(int argc, char *argv[])
+{
+  const char *header = "-WXR-TOR-048113-048215-048439-048085+0030-2911530-KEC80/NW-";
+  uint32_t i, iterations = BENCH_ITERATIONS, failed = 0;
+  uint8_t frame[FRAME_MAX_SIZE];
+  char json[512];
+  uint16_t frameLength = 0, jsonLength = 0;
+  volatile uint32_t sink = 0;
+  SameFrame decoded;
+  double start, encode, decode, text;
+  int option;
+
+  while ((option = getopt(argc, argv, "n:h:")) != -1)
+    switch (option)
+      {
+        case 'n':  iterations = atoi(optarg);  break;
+        case 'h':  header = optarg;            break;
+        default:
+                  fprintf(stderr, "usage: %s [-n iterations] [-h header]\n", argv[0]);
+                  return 2;
+      }
+
+  if (!iterations)
+    return 2;
+
+  hostBegin();
+  clockVirtual();
+  radio.reset();
+  radio.signal(40, 20, 0);
+  busBackend(benchTransfer);
+  memset(nvMemory, 0xFF, sizeof(nvMemory));
+  Radio.nvBackend(benchNvRead, benchNvWrite, sizeof(nvMemory));
+
+  Radio.begin();
+  Wire.begin();
+  Radio.execute(benchBoot);
+
+  if (!benchParse(header))
+    {
+      fprintf(stderr, "The Header was not parsed: %s\n", header);
+      return 1;
+    }
+
+  Radio.getRsqStatus(CHECK);
+
+  start = benchSeconds();
+
+  for (i = 0; i < iterations; i++)
+    {
+      frameLength = Radio.frameEncode(FRAME_ALERT, frame, sizeof(frame));
+      sink += frame[frameLength - 1];
+    }
+
+  encode = benchSeconds() - start;
+  start = benchSeconds();
+
+  for (i = 0; i < iterations; i++)
+    {
+      failed += frameDecode(frame, frameLength, &decoded) != frameLength;
+      sink += decoded.locations;
+    }
+
+  decode = benchSeconds() - start;
+  start = benchSeconds();
+
+  for (i = 0; i < iterations; i++)
+    {
+      jsonLength = Radio.jsonEncode(FRAME_ALERT, json, sizeof(json));
+      sink += json[jsonLength - 1];
+    }
+
+  text = benchSeconds() - start;
+
+  if (!failed && !benchMatch(decoded))
+    failed = 1;
+
+  printf("%s", json);
+  printf("frameEncode  %4u bytes  %7.1f ns  %7.1f MB/s\n", frameLength, encode / iterations * 1e9, frameLength * iterations / encode / 1e6);
+  printf("frameDecode  %4u bytes  %7.1f ns  %7.1f MB/s\n", frameLength, decode / iterations * 1e9, frameLength * iterations / decode / 1e6);
+  printf("jsonEncode   %4u bytes  %7.1f ns  %7.1f MB/s\n", jsonLength, text / iterations * 1e9, jsonLength * iterations / text / 1e6);
+
+  if (failed)
+    {
+      fprintf(stderr, "%u frames did not decode back to the parse.\n", failed);
+      return 1;
+    }
+
+  return 0;
+}
+
+#endif  //  End of SI4707Bench.cpp
@@ -0,0 +1,420 @@
+/*
+  SI4707Bus.cpp - Linux i2c-dev bus worker for the SI4707 library.
+
+  Copyright 2013 by Ray H. Dees
+  Copyright 2013 by AIW Industries, LLC
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#if defined(__linux__)
+
+#include "SI4707Bus.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <linux/i2c-dev.h>
+//
+//  Shared with the worker only through the rings and the eventfds.
+//
+static BusRing<BusRequest, BUS_RING_SIZE> requests;
+static BusRing<BusEvent, BUS_RING_SIZE> events;
+static int requestFd = -1;                       //  Wakes the worker.
+static int eventFd = -1;                         //  Wakes the application thread.
+static std::atomic<uint8_t> interruptQueued(0);  //  At most one BUS_INTERRUPT in the ring.
+//
+//  Worker only, or set before it starts.
+//
+static int busFd = -1;
+static int lineFd = -2;                          //  Interrupt line, -1 to poll, -2 for none.
+static BusTransfer transferHook = NULL;
+static pthread_t worker;
+//
+//  Application thread only.
+//
+static uint8_t running;
+static uint8_t masked;
+static uint8_t interruptPending;
+static uint32_t sequence;
+static void (*interruptHandler)(void);
+//
+//  Monotonic msec.
+//
+static uint32_t busMillis(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return uint32_t(now.tv_sec * 1000UL + now.tv_nsec / 1000000UL);
+}
+//
+//  Adds one to an eventfd.
+//
+static void busSignal(int fd)
+{
+  uint64_t one = 1;
+
+  if (write(fd, &one, sizeof(one)) < 0)
+    return;
+}
+//
+//  Sends a request to the worker.
+//
+static uint8_t busSend(const BusRequest &request)
+{
+  if (!requests.push(request))
+    return 0;
+
+  busSignal(requestFd);
+  return 1;
+}
+//
+//  Worker:  Queues an interrupt, unless one is already waiting.
+//
+static void busRaise(void)
+{
+  BusEvent event;
+
+  if (interruptQueued.exchange(1))
+    return;
+
+  event.type = BUS_INTERRUPT;
+  event.status = BUS_OK;
+  event.length = 0;
+  event.sequence = 0;
+
+  if (events.push(event))
+    busSignal(eventFd);
+  else
+    interruptQueued.store(0);
+}
+//
+//  Worker:  Runs one write or one read as a single I2C_RDWR.
+//
+static uint8_t busRun(BusRequest &request, BusEvent &event)
+{
+  struct i2c_msg msg;
+  struct i2c_rdwr_ioctl_data transfer;
+  int result;
+
+  msg.addr = request.address;
+
+  if (request.readLength)
+    {
+      msg.flags = I2C_M_RD;
+      msg.len = request.readLength;
+      msg.buf = event.data;
+    }
+
+  else
+    {
+      msg.flags = 0;
+      msg.len = request.writeLength;
+      msg.buf = request.data;
+    }
+
+  if (transferHook)
+    result = transferHook(&msg, 1);
+
+  else
+    {
+      transfer.msgs = &msg;
+      transfer.nmsgs = 1;
+      result = (ioctl(busFd, I2C_RDWR, &transfer) < 0) ? -errno : 0;
+    }
+
+  event.length = (result < 0) ? 0 : request.readLength;
+
+  if (result == -ENXIO || result == -EREMOTEIO)
+    return BUS_NACK;
+
+  return (result < 0) ? BUS_ERROR : BUS_OK;
+}
+//
+//  Worker:  Owns the bus, runs requests in order and watches the interrupt line.
+//
+static void *busWorker(void *)
+{
+  struct pollfd fds[2];
+  struct gpio_v2_line_event edges[4];
+  BusRequest request;
+  BusEvent event;
+  uint64_t count;
+  uint32_t next = busMillis() + BUS_POLL_INTERVAL;
+  int line = lineFd;
+  int32_t wait;
+
+  for (;;)
+    {
+      fds[0].fd = requestFd;
+      fds[0].events = POLLIN;
+      fds[1].fd = line;                          //  poll() skips a negative fd.
+      fds[1].events = POLLIN;
+      fds[1].revents = 0;
+
+      wait = int32_t(next - busMillis());
+
+      if (line == -1 && wait <= 0)
+        {
+          busRaise();
+          next = busMillis() + BUS_POLL_INTERVAL;
+          wait = BUS_POLL_INTERVAL;
+        }
+
+      if (poll(fds, 2, (line == -1) ? wait : -1) <= 0)
+        continue;
+
+      if (fds[1].revents & POLLIN)
+        {
+          if (read(line, edges, sizeof(edges)) > 0)
+            busRaise();
+        }
+
+      else if (fds[1].revents & (POLLERR | POLLNVAL))
+        line = -2;                               //  Closed under us, wait for the next BUS_ATTACH.
+
+      if (!(fds[0].revents & POLLIN))
+        continue;
+
+      if (read(requestFd, &count, sizeof(count)) < 0)
+        continue;
+
+      while (requests.pop(request))
+        {
+          switch (request.type)
+            {
+              case BUS_TRANSFER:
+                        event.type = BUS_DONE;
+                        event.sequence = request.sequence;
+                        event.status = busRun(request, event);
+
+                        while (!events.push(event))
+                          usleep(100);           //  Only if the application stopped reading.
+
+                        busSignal(eventFd);
+                        break;
+
+              case BUS_ATTACH:
+                        line = request.fd;
+                        break;
+
+              case BUS_STOP:
+                        return NULL;
+            }
+        }
+    }
+}
+//
+//  Opens the bus, SI4707_I2C or /dev/i2c-1, and starts the worker.
+//
+uint8_t busBegin(void)
+{
+  const char *path = getenv("SI4707_I2C");
+
+  if (running)
+    return 1;
+
+  if (requestFd < 0)
+    requestFd = eventfd(0, EFD_CLOEXEC);
+
+  if (eventFd < 0)
+    eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  if (requestFd < 0 || eventFd < 0)
+    return 0;
+
+  if (!transferHook)
+    {
+      busFd = open(path ? path : "/dev/i2c-1", O_RDWR | O_CLOEXEC);
+
+      if (busFd < 0)
+        return 0;
+    }
+
+  if (pthread_create(&worker, NULL, busWorker, NULL))
+    {
+      if (busFd >= 0)
+        close(busFd);
+
+      busFd = -1;
+      return 0;
+    }
+
+  running = 1;
+  return 1;
+}
+//
+//  Stops the worker and closes the bus.
+//
+void busEnd(void)
+{
+  BusRequest request;
+  BusEvent event;
+
+  if (!running)
+    return;
+
+  request.type = BUS_STOP;
+
+  while (!busSend(request))
+    usleep(100);
+
+  pthread_join(worker, NULL);
+  running = 0;
+
+  if (busFd >= 0)
+    close(busFd);
+
+  busFd = -1;
+
+  while (events.pop(event))                      //  Drops completions nobody waited for.
+    if (event.type == BUS_INTERRUPT)
+      {
+        interruptQueued.store(0);
+        interruptPending = 1;                    //  Held for busDispatch(), the handler is not run from here.
+      }
+}
+//
+//  Replaces the i2c-dev ioctl, before busBegin().  NULL restores it.
+//
+void busBackend(BusTransfer transfer)
+{
+  transferHook = transfer;
+}
+//
+//  Writes or reads, one of writeLength and readLength, and waits for the
+//  worker.  Returns BUS_OK, BUS_NACK or BUS_ERROR.
+//
+uint8_t busTransfer(uint8_t address, const uint8_t *write, uint8_t writeLength, uint8_t *read, uint8_t readLength)
+{
+  BusRequest request;
+  BusEvent event;
+  uint32_t start = busMillis();
+
+  if (!running || (writeLength && readLength) || writeLength > BUS_BUFFER_SIZE || readLength > BUS_BUFFER_SIZE)
+    return BUS_ERROR;
+
+  request.type = BUS_TRANSFER;
+  request.address = address;
+  request.writeLength = writeLength;
+  request.readLength = readLength;
+  request.sequence = ++sequence;
+
+  if (writeLength)
+    memcpy(request.data, write, writeLength);
+
+  if (!busSend(request))
+    return BUS_ERROR;
+
+  for (;;)
+    {
+      while (events.pop(event))
+        {
+          if (event.type == BUS_INTERRUPT)
+            {
+              interruptQueued.store(0);
+              interruptPending = 1;
+            }
+
+          else if (event.sequence == request.sequence)
+            {
+              if (event.length)
+                memcpy(read, event.data, event.length);
+
+              return event.status;               //  An interrupt waits for busDispatch() between passes.
+            }
+        }
+
+      if (busMillis() - start >= BUS_TIMEOUT)
+        return BUS_ERROR;                        //  A late completion is dropped by its sequence.
+
+      busWait(BUS_TIMEOUT - (busMillis() - start));
+    }
+}
+//
+//  Watches a GPIO line event fd, or polls with -1, and calls handler on the
+//  application thread from busDispatch().
+//
+void busAttach(int fd, void (*handler)(void))
+{
+  BusRequest request;
+
+  interruptHandler = handler;
+
+  if (!running)
+    {
+      lineFd = fd;
+      return;
+    }
+
+  request.type = BUS_ATTACH;
+  request.fd = fd;
+  lineFd = fd;                                   //  For the next busBegin().
+
+  while (!busSend(request))
+    usleep(100);
+}
+//
+//  Sleeps until the worker has something, at most timeout msec.  Returns 1 if it has.
+//
+uint8_t busWait(uint32_t timeout)
+{
+  struct pollfd fd;
+  uint64_t count;
+
+  fd.fd = eventFd;
+  fd.events = POLLIN;
+
+  if (eventFd < 0 || poll(&fd, 1, timeout) <= 0)
+    return 0;
+
+  return (read(eventFd, &count, sizeof(count)) > 0);
+}
+//
+//  Takes worker events and calls the interrupt handler, unless masked.
+//
+void busDispatch(void)
+{
+  BusEvent event;
+
+  while (events.pop(event))
+    if (event.type == BUS_INTERRUPT)
+      {
+        interruptQueued.store(0);
+        interruptPending = 1;
+      }
+
+  if (masked || !interruptPending || !interruptHandler)
+    return;
+
+  interruptPending = 0;
+  interruptHandler();
+}
+//
+//  noInterrupts() and interrupts().  An interrupt while masked is held for the
+//  first busDispatch() after it is unmasked.
+//
+void busMask(uint8_t mask)
+{
+  masked = mask;
+}
+
+#endif  //  __linux__
@@ -0,0 +1,134 @@
+/*
+  SI4707Bus.h - Linux i2c-dev bus worker for the SI4707 library.
+
+  Copyright 2013 by Ray H. Dees
+  Copyright 2013 by AIW Industries, LLC
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+  One worker thread owns the I2C bus.  The application thread hands it
+  requests through a single-producer, single-consumer ring and gets back
+  completions and interrupts through a second one, so neither side ever
+  takes a lock.  Each request is one I2C_RDWR transfer, a write or a read,
+  each ended with a STOP.  The Si4707 has no register to point a read at,
+  its response is read on its own once CTS is set, so nothing joins the two.
+
+  Interrupts come from a GPIO character device line edge, or, with no line
+  configured, are raised every BUS_POLL_INTERVAL so the driver polls the
+  status instead.
+
+  busBackend() replaces the ioctl with a function, so the driver can be run
+  against a userspace stand-in for the Si4707 with no hardware at all.
+*/
+#ifndef SI4707Bus_h
+#define SI4707Bus_h
+//
+#include <stdint.h>
+#include <atomic>
+#include <linux/i2c.h>
+//
+#define BUS_RING_SIZE                    16      //  Entries in each ring, a power of 2.
+#define BUS_BUFFER_SIZE                  32      //  Largest write or read in one request, as Wire.
+#define BUS_TIMEOUT                    1000      //  Longest wait for a transfer (msec).
+#define BUS_POLL_INTERVAL                10      //  Interrupt rate with no GPIO line (msec).
+//
+#define BUS_TRANSFER                   0x01      //  Request:  Write and/or read.
+#define BUS_ATTACH                     0x02      //  Request:  Watch a new GPIO line event fd.
+#define BUS_STOP                       0x03      //  Request:  End the worker.
+#define BUS_DONE                       0x81      //  Event:  A transfer completed, see status.
+#define BUS_INTERRUPT                  0x82      //  Event:  The interrupt line fell, or a poll is due.
+//
+#define BUS_OK                            0      //  Status values, as Wire.endTransmission().
+#define BUS_NACK                          2
+#define BUS_ERROR                         4
+//
+//  A lock-free ring with one producer thread and one consumer thread.
+//
+template <typename T, uint16_t N>
+class BusRing
+{
+  public:
+    BusRing() : head(0), tail(0) { }
+
+    bool push(const T &item)
+      {
+        uint16_t h = head.load(std::memory_order_relaxed);
+
+        if (uint16_t(h - tail.load(std::memory_order_acquire)) == N)
+          return false;
+
+        slot[h & (N - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+      }
+
+    bool pop(T &item)
+      {
+        uint16_t t = tail.load(std::memory_order_relaxed);
+
+        if (t == head.load(std::memory_order_acquire))
+          return false;
+
+        item = slot[t & (N - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+      }
+
+  private:
+    static_assert(N && !(N & (N - 1)), "BusRing size must be a power of 2.");
+
+    T slot[N];
+    std::atomic<uint16_t> head;
+    std::atomic<uint16_t> tail;
+};
+//
+//  Application thread to worker.
+//
+struct BusRequest
+{
+  uint8_t type;
+  uint8_t address;
+  uint8_t writeLength;                           //  0 for a read only.
+  uint8_t readLength;                            //  0 for a write only.
+  uint8_t data[BUS_BUFFER_SIZE];
+  int fd;                                        //  BUS_ATTACH line event fd, -1 to poll.
+  uint32_t sequence;
+};
+//
+//  Worker to application thread.
+//
+struct BusEvent
+{
+  uint8_t type;
+  uint8_t status;
+  uint8_t length;
+  uint8_t data[BUS_BUFFER_SIZE];
+  uint32_t sequence;
+};
+//
+//  Replaces ioctl(I2C_RDWR).  Returns a negative errno on failure.
+//
+typedef int (*BusTransfer)(struct i2c_msg *msgs, uint32_t count);
+//
+uint8_t busBegin(void);
+void busEnd(void);
+void busBackend(BusTransfer transfer);
+uint8_t busTransfer(uint8_t address, const uint8_t *write, uint8_t writeLength, uint8_t *read, uint8_t readLength);
+void busAttach(int fd, void (*handler)(void));
+uint8_t busWait(uint32_t timeout);
+void busDispatch(void);
+void busMask(uint8_t mask);
+
+#endif  //  End of SI4707Bus.h
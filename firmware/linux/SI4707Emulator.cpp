@@ -0,0 +1,388 @@
+/*
+  SI4707Emulator.cpp - A userspace stand-in for the Si4707, behind SI4707Bus.
+
+  Copyright 2013 by Ray H. Dees
+  Copyright 2013 by AIW Industries, LLC
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#if defined(__linux__)
+
+#include "SI4707Emulator.h"
+#include <errno.h>
+#include <string.h>
+//
+//  Powered down, nothing on the air, a fair signal.
+//
+void SI4707Emulator::reset(void)
+{
+  void (*handler)(void) = lineHandler;
+
+  memset(this, 0, sizeof(*this));
+  lineHandler = handler;
+  rssi = 40;
+  snr = 20;
+}
+//
+//  One I2C_RDWR transfer.  Returns 0, or a negative errno as the ioctl would.
+//
+int SI4707Emulator::transfer(struct i2c_msg *msgs, uint32_t count)
+{
+  uint32_t i;
+
+  if (failure == FAULT_NACK)
+    return -ENXIO;
+
+  if (failure == FAULT_ERROR)
+    return -EIO;
+
+  for (i = 0; i < count; i++)
+    {
+      if (msgs[i].addr != RADIO_ADDRESS)
+        return -ENXIO;
+
+      if (!(msgs[i].flags & I2C_M_RD))
+        {
+          if (failure != FAULT_FLOAT)
+            command(msgs[i].buf, msgs[i].len);
+
+          continue;
+        }
+
+      if (failure == FAULT_FLOAT)
+        {
+          memset(msgs[i].buf, 0xFF, msgs[i].len);
+          continue;
+        }
+
+      memset(msgs[i].buf, 0, msgs[i].len);
+      reply[0] = status();
+      memcpy(msgs[i].buf, reply, (msgs[i].len < replyLength) ? msgs[i].len : replyLength);
+    }
+
+  edge();
+  return 0;
+}
+//
+//  Runs a command, leaving its response in reply.
+//
+void SI4707Emulator::command(const uint8_t *args, uint16_t length)
+{
+  uint8_t mode = (length > 1) ? args[1] : 0;
+  uint8_t i, address;
+
+  memset(reply, 0, sizeof(reply));
+  replyLength = 1;
+
+  switch (args[0])
+    {
+      case POWER_UP:
+                powered = 1;
+                break;
+
+      case POWER_DOWN:
+                powered = 0;
+                stcInt = rsqInt = sameInt = asqInt = 0;
+                break;
+
+      case GET_REV:
+                reply[1] = 7;                    //  Si4707.
+                reply[2] = '2';
+                reply[3] = '0';
+                reply[6] = '2';
+                reply[7] = '0';
+                reply[8] = 'B';
+                replyLength = 9;
+                break;
+
+      case SET_PROPERTY:
+                if (length >= 6)
+                  propertySet(args[2] << 8 | args[3], args[4] << 8 | args[5]);
+                break;
+
+      case GET_PROPERTY:
+                if (length >= 4)
+                  {
+                    reply[2] = highByte(property(args[2] << 8 | args[3]));
+                    reply[3] = lowByte(property(args[2] << 8 | args[3]));
+                  }
+                replyLength = 4;
+                break;
+
+      case WB_TUNE_FREQ:
+                if (length >= 4)
+                  channel = args[2] << 8 | args[3];
+                stcInt = 1;
+                sameLength = sameState = sameInt = 0;
+                memset(sameConfidence, 0, sizeof(sameConfidence));
+                break;
+
+      case WB_TUNE_STATUS:
+                if (mode & INTACK)
+                  stcInt = 0;
+                reply[1] = (snr >= property(WB_VALID_SNR_THRESHOLD) && rssi >= property(WB_VALID_RSSI_THRESHOLD)) ? VALID : 0;
+                reply[2] = highByte(channel);
+                reply[3] = lowByte(channel);
+                reply[4] = rssi;
+                reply[5] = snr;
+                replyLength = 6;
+                break;
+
+      case WB_RSQ_STATUS:
+                reply[1] = rsqInt;
+                if (mode & INTACK)
+                  rsqInt = 0;
+                reply[2] = (snr >= property(WB_VALID_SNR_THRESHOLD) && rssi >= property(WB_VALID_RSSI_THRESHOLD)) ? VALID : 0;
+                if ((freqoff < 0 ? -freqoff : freqoff) >= property(WB_MAX_TUNE_ERROR))
+                  reply[2] |= AFCRL;
+                reply[4] = rssi;
+                reply[5] = snr;
+                reply[7] = uint8_t(freqoff * 2);
+                replyLength = 8;
+                break;
+
+      case WB_SAME_STATUS:
+                if (mode & CLRBUF)
+                  {
+                    sameLength = sameState = 0;
+                    memset(sameConfidence, 0, sizeof(sameConfidence));
+                  }
+
+                reply[1] = sameInt;
+                if (mode & INTACK)
+                  sameInt = 0;
+
+                address = (length > 2) ? args[2] : 0;
+                reply[2] = sameState;
+                reply[3] = sameLength;
+
+                for (i = 0; i < 8 && address + i < SAME_BUFFER_SIZE; i++)
+                  {
+                    reply[(i < 4) ? 5 : 4] |= sameConfidence[address + i] << ((i & 0x03) * 2);
+                    reply[i + 6] = sameText[address + i];
+                  }
+                replyLength = 14;
+                break;
+
+      case WB_ASQ_STATUS:
+                reply[1] = asqInt;
+                if (mode & INTACK)
+                  asqInt = 0;
+                reply[2] = tone ? ALERT : 0;
+                replyLength = 3;
+                break;
+
+      case WB_AGC_STATUS:
+                reply[1] = agcDisabled;
+                replyLength = 2;
+                break;
+
+      case WB_AGC_OVERRIDE:
+                agcDisabled = mode & 0x01;
+                break;
+
+      default:                                   //  GET_INT_STATUS, GPIO_CTL, GPIO_SET and patch data.
+                break;
+    }
+}
+//
+//  The status byte, CTS and the interrupts that are pending.
+//
+uint8_t SI4707Emulator::status(void)
+{
+  uint8_t value = CTSINT;
+
+  if (stcInt)
+    value |= STCINT;
+
+  if (rsqInt)
+    value |= RSQINT;
+
+  if (sameInt & property(WB_SAME_INTERRUPT_SOURCE))
+    value |= SAMEINT;
+
+  if (asqInt & property(WB_ASQ_INT_SOURCE))
+    value |= ASQINT;
+
+  return value;
+}
+//
+//  The GPO2 interrupt line, CTS aside.
+//
+uint8_t SI4707Emulator::line(void)
+{
+  return powered && (status() & property(GPO_IEN) & (STCINT | ASQINT | SAMEINT | RSQINT | ERRINT));
+}
+//
+//  handler is called on each falling edge of the interrupt line, from inside
+//  transfer() or the air calls, as an interrupt would break into the driver.
+//
+void SI4707Emulator::attach(void (*handler)(void))
+{
+  lineHandler = handler;
+  lineLevel = 0;
+}
+//
+//  The line pulses when an interrupt becomes pending, one already pending
+//  does not pulse again until it is cleared (the *REP bits are not set).
+//
+void SI4707Emulator::edge(void)
+{
+  uint8_t pending = powered ? status() & property(GPO_IEN) & (STCINT | ASQINT | SAMEINT | RSQINT | ERRINT) : 0;
+  uint8_t raised = pending & ~lineLevel;
+
+  lineLevel = pending;
+
+  if (raised && lineHandler)
+    lineHandler();
+}
+//
+//  Returns a property, or the Si4707 default for the ones that matter here.
+//
+uint16_t SI4707Emulator::property(uint16_t id)
+{
+  uint8_t i;
+
+  for (i = 0; i < propertyCount; i++)
+    if (propertyId[i] == id)
+      return propertyValue[i];
+
+  switch (id)
+    {
+      case WB_RSQ_SNR_HIGH_THRESHOLD:
+      case WB_RSQ_RSSI_HIGH_THRESHOLD:
+                return 127;
+
+      case WB_VALID_SNR_THRESHOLD:
+                return 3;
+
+      case WB_VALID_RSSI_THRESHOLD:
+                return 20;
+
+      case WB_MAX_TUNE_ERROR:
+                return 10;
+
+      default:
+                return 0;
+    }
+}
+
+void SI4707Emulator::propertySet(uint16_t id, uint16_t value)
+{
+  uint8_t i;
+
+  for (i = 0; i < propertyCount && propertyId[i] != id; i++)
+    ;
+
+  if (i == EMULATOR_PROPERTIES)
+    return;
+
+  propertyId[i] = id;
+  propertyValue[i] = value;
+
+  if (i == propertyCount)
+    propertyCount++;
+
+  if (id >= WB_RSQ_INT_SOURCE && id <= WB_RSQ_RSSI_LOW_THRESHOLD)
+    rsqCheck();
+}
+//
+//  Raises the RSQ interrupts the present signal crosses.
+//
+void SI4707Emulator::rsqCheck(void)
+{
+  uint16_t sources = property(WB_RSQ_INT_SOURCE);
+
+  if (sources & RSSILIEN && rssi < property(WB_RSQ_RSSI_LOW_THRESHOLD))
+    rsqInt |= RSSILINT;
+
+  if (sources & RSSIHIEN && rssi > property(WB_RSQ_RSSI_HIGH_THRESHOLD))
+    rsqInt |= RSSIHINT;
+
+  if (sources & SNRLIEN && snr < property(WB_RSQ_SNR_LOW_THRESHOLD))
+    rsqInt |= SNRLINT;
+
+  if (sources & SNRHIEN && snr > property(WB_RSQ_SNR_HIGH_THRESHOLD))
+    rsqInt |= SNRHINT;
+}
+//
+//  The air.
+//
+void SI4707Emulator::signal(uint8_t rssi, uint8_t snr, int8_t freqoff)
+{
+  this->rssi = rssi;
+  this->snr = snr;
+  this->freqoff = freqoff;
+  rsqCheck();
+  edge();
+}
+
+void SI4707Emulator::samePreamble(void)
+{
+  sameInt |= PREDET | SOMDET;
+  sameState = 1;
+  edge();
+}
+//
+//  A Header has been received.  Each clean copy raises the confidence of
+//  its bytes, a damaged one leaves bytes never received clean unusable.
+//
+void SI4707Emulator::sameHeader(const char *header, uint8_t damaged)
+{
+  uint8_t i;
+
+  for (i = 0; header[i] && i < SAME_BUFFER_SIZE; i++)
+    {
+      if (damaged)
+        {
+          if (!sameConfidence[i])
+            sameText[i] = 'X';
+        }
+
+      else if (sameConfidence[i] && sameText[i] == header[i])
+        sameConfidence[i] += (sameConfidence[i] < 3);
+
+      else
+        {
+          sameText[i] = header[i];
+          sameConfidence[i] = 1;
+        }
+    }
+
+  sameLength = i;
+  sameState = 2;
+  sameInt |= HDRRDY;
+  edge();
+}
+
+void SI4707Emulator::sameEom(void)
+{
+  sameInt |= EOMDET;
+  sameState = 0;
+  edge();
+}
+
+void SI4707Emulator::alertTone(uint8_t on)
+{
+  tone = on;
+  asqInt |= on ? ALERTON : ALERTOF;
+  edge();
+}
+
+void SI4707Emulator::fault(uint8_t kind)
+{
+  failure = kind;
+}
+
+#endif  //  __linux__
@@ -0,0 +1,100 @@
+/*
+  SI4707Emulator.h - A userspace stand-in for the Si4707, behind SI4707Bus.
+
+  Copyright 2013 by Ray H. Dees
+  Copyright 2013 by AIW Industries, LLC
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+  Answers the commands SI4707.cpp sends with what the part would, as far as
+  the driver can tell.  The caller plays the air:  signal() for fades,
+  samePreamble()/sameHeader()/sameEom() for SAME bursts and alertTone() for
+  the 1050 Hz tone, and fault() breaks the bus.  Commands complete at once,
+  so CTS is always set.  attach() takes the interrupt handler, called on the
+  line's edges only.
+
+  Hand transfer() to busBackend() through a plain function, e.g.
+
+    static int emulate(struct i2c_msg *msgs, uint32_t count) { return radio.transfer(msgs, count); }
+*/
+#ifndef SI4707Emulator_h
+#define SI4707Emulator_h
+//
+#include "SI4707.h"
+#include <linux/i2c.h>
+//
+#define FAULT_NONE                        0      //  The bus works.
+#define FAULT_NACK                        1      //  The Si4707 does not answer its address.
+#define FAULT_ERROR                       2      //  The adapter reports a bus error.
+#define FAULT_FLOAT                       3      //  Reads return 0xFF, a bus with nothing driving it.
+//
+#define EMULATOR_PROPERTIES              32      //  Properties remembered.
+//
+class SI4707Emulator
+{
+  public:
+    void reset(void);
+    int transfer(struct i2c_msg *msgs, uint32_t count);
+
+    void signal(uint8_t rssi, uint8_t snr, int8_t freqoff);
+    void samePreamble(void);
+    void sameHeader(const char *header, uint8_t damaged);
+    void sameEom(void);
+    void alertTone(uint8_t on);
+    void fault(uint8_t kind);
+
+    void attach(void (*handler)(void));
+    uint8_t line(void);
+    uint16_t property(uint16_t id);
+    uint16_t tunedChannel(void) { return channel; }
+
+  private:
+    void command(const uint8_t *args, uint16_t length);
+    uint8_t status(void);
+    void rsqCheck(void);
+    void propertySet(uint16_t id, uint16_t value);
+    void edge(void);
+
+    uint8_t powered;
+    uint8_t failure;
+    uint16_t channel;
+    uint8_t rssi;
+    uint8_t snr;
+    int8_t freqoff;
+
+    uint8_t stcInt;
+    uint8_t rsqInt;
+    uint8_t sameInt;
+    uint8_t asqInt;
+    uint8_t tone;
+    uint8_t agcDisabled;
+
+    char sameText[SAME_BUFFER_SIZE];
+    uint8_t sameConfidence[SAME_BUFFER_SIZE];
+    uint8_t sameLength;
+    uint8_t sameState;
+
+    uint16_t propertyId[EMULATOR_PROPERTIES];
+    uint16_t propertyValue[EMULATOR_PROPERTIES];
+    uint8_t propertyCount;
+
+    uint8_t reply[16];                           //  Response to the last command.
+    uint8_t replyLength;
+
+    uint8_t lineLevel;                           //  Interrupts pending on the line, see edge().
+    void (*lineHandler)(void);
+};
+
+#endif  //  End of SI4707Emulator.h
@@ -0,0 +1,821 @@
+/*
+  SI4707Soak.cpp - Soak test of the SI4707 library against emulated receivers.
+
+  Copyright 2013 by Ray H. Dees
+  Copyright 2013 by AIW Industries, LLC
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+  Runs the unmodified driver against SI4707Emulator on a virtual clock, so
+  a year of a receiver's traffic takes seconds.  Each receiver is its own
+  process, since the driver keeps its state in globals, and up to -j of
+  them run at once.  Each one gets its own random air:
+
+    Alerts     Three Headers, an Alert Tone half the time, a message and three EOMs.
+    Fades      RSSI and SNR drop and the frequency drifts for 1 to 20 seconds.
+               A Header or EOM sent during a fade is damaged.
+    Faults     The bus NACKs, errors or floats for 10 msec to 2 seconds.
+    Interrupts Events due within -m msec of a read land right after it, before
+               the driver has taken the status it read.
+    Repeats    A parsed alert is broadcast again 1 to 5 minutes later, with -r
+               probability.  Every repeat with a clean Header must be reported
+               as a duplicate, and never parsed.
+    Restarts   The driver restarts while the air is quiet, -R times a day.  The
+               alert log it recovers must hold the newest alerts parsed, and
+               the stored channel history the time of the first SAME.
+
+  For every receiver it reports the alerts sent, missed (at least one Header
+  was clean, but nothing was parsed), lost (every Header damaged), duplicates
+  and stray parses, the latency from the end of the first clean Header to
+  the parse, the I2C health counters and the CPU time the receiver took.
+  The summary adds the relockTime and decodeTime frontService() measured
+  after fades, under the front end policy given with -p (FRONT_AGC_FREEZE
+  and FRONT_AFC_RETUNE, both by default), and the repeats and restarts.
+
+    g++ -std=gnu++11 -O2 -Ifirmware/linux -Ifirmware firmware/linux/SI4707Soak.cpp \
+        firmware/linux/SI4707Emulator.cpp firmware/SI4707.cpp firmware/linux/application.cpp \
+        firmware/linux/SI4707Bus.cpp -pthread -o si4707-soak
+
+    si4707-soak [-n receivers] [-d days] [-j jobs] [-s seed] [-a alerts/day] [-f fades/day] [-b faults/day]
+                [-r repeat probability] [-R restarts/day] [-m msec] [-p policy] [-q]
+
+  Exits 1 if any receiver missed an alert it could have decoded, did not
+  report a repeat as a duplicate, or recovered the wrong log or history.
+*/
+#if defined(__linux__)
+
+#include "SI4707.h"
+#include "SI4707Bus.h"
+#include "SI4707Emulator.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+//
+#define SOAK_STEP                     10000      //  Virtual usec between passes while anything is going on.
+#define SOAK_TICK                      1000      //  Virtual usec between passes while tick() reads status.
+#define SOAK_ACTIONS                     32      //  Scheduled air events per receiver.
+#define SOAK_LATENCIES                 4096      //  Latencies kept per receiver.
+#define SOAK_BIT                       1920      //  usec per SAME bit, 520.83 bps.
+#define SOAK_SECOND                 1000000ULL
+#define SOAK_LOGGED                     256      //  Hashes of the alerts logged, newest last.
+//
+#define ACT_ALERT                         1      //  Start the next alert.
+#define ACT_PREAMBLE                      2
+#define ACT_HEADER                        3
+#define ACT_EOM                           4
+#define ACT_TONE_ON                       5
+#define ACT_TONE_OFF                      6
+#define ACT_CHECK                         7      //  The alert is over, was it parsed?
+#define ACT_FADE_ON                       8
+#define ACT_FADE_OFF                      9
+#define ACT_FAULT_ON                     10
+#define ACT_FAULT_OFF                    11
+#define ACT_REPEAT                       12      //  Broadcast the last alert again.
+#define ACT_RESTART                      13      //  Restart the driver once the air is quiet.
+//
+struct SoakOptions
+{
+  uint32_t receivers;
+  uint32_t days;
+  uint32_t jobs;
+  uint32_t seed;
+  double alertRate;                              //  Per day.
+  double fadeRate;
+  double faultRate;
+  double repeatRate;                             //  Probability.
+  double restartRate;                            //  Per day.
+  uint32_t midWindow;                            //  msec.
+  uint8_t policy;
+  uint8_t quiet;
+};
+//
+//  Written by the receiver's process into memory shared with the parent.
+//
+struct SoakResult
+{
+  uint32_t alerts;
+  uint32_t delivered;
+  uint32_t missed;
+  uint32_t lost;
+  uint32_t duplicates;
+  uint32_t strays;
+  uint32_t repeats;
+  uint32_t repeatsHeard;                         //  Repeats with a clean Header, each a duplicate.
+  uint32_t restarts;
+  uint32_t restartsWrong;                        //  Restarts that recovered the wrong log or history.
+  uint32_t rsqReports;
+  uint16_t i2cErrors;
+  uint16_t i2cRetries;
+  uint16_t i2cRecoveries;
+  uint64_t cpuMicros;
+  uint32_t latencyCount;
+  uint32_t latency[SOAK_LATENCIES];              //  msec.
+  uint32_t relockCount;
+  uint32_t relock[SOAK_LATENCIES];               //  relockTime, msec.
+  uint32_t decodeCount;
+  uint32_t decode[SOAK_LATENCIES];               //  decodeTime, msec.
+  uint8_t done;
+};
+//
+struct SoakAction
+{
+  uint64_t time;
+  uint8_t type;
+};
+//
+//  One receiver's state, one per process.
+//
+static SI4707Emulator radio;
+static SoakResult *result;
+static SoakAction actions[SOAK_ACTIONS];
+static uint8_t actionCount;
+static uint64_t randomState;
+static uint8_t nvMemory[EEPROM_SIZE];
+static uint8_t baseRssi, baseSnr;
+
+static char header[64];                          //  The alert on the air.
+static uint16_t alertTime;                       //  Its HHMM, as sameTime.
+static uint8_t alertActive;
+static uint8_t alertClean;                       //  At least one Header got through.
+static uint8_t alertParsed;
+static uint8_t alertRepeat;                      //  The alert on the air is a repeat.
+static uint8_t repeatPending;
+static uint64_t alertDecodable;                  //  End of the first clean Header.
+static uint64_t burstStart;
+static uint8_t eomSeen;
+
+static uint64_t fadeStart, fadeEnd;
+static uint8_t faultActive;
+
+static uint32_t logged[SOAK_LOGGED];             //  sameHash of every alert parsed, each one logged.
+static uint32_t loggedCount;
+static uint32_t channelHeard;                    //  Time.now() of the first SAME, as the history stores it.
+static const SoakOptions *soakOptions;           //  For the events played inside a transfer.
+
+static const char *const soakEvents[] = { "TOR", "SVR", "FFW", "RWT", "RMT", "SVS", "WSW", "FLW" };
+//
+//  Radio Profile, as the example sketch.
+//
+constexpr RadioProfile soakProfile =
+{
+  1,
+  CTSIEN | ERRIEN | RSQIEN | SAMEIEN | ASQIEN | STCIEN,
+  EOMDETIEN | HDRRDYIEN | PREDETIEN,
+  ALERTOFIEN | ALERTONIEN,
+  SNRHIEN | SNRLIEN | RSSIHIEN | RSSILIEN,
+  127, 0, 127, 0,
+  3, 20,
+  RADIO_VOLUME,
+  OFF,
+  162550,
+};
+
+RADIO_PROFILE(soakBoot, soakProfile);
+//
+//  xorshift64*, uniform in [0, 1).
+//
+static double soakRandom(void)
+{
+  randomState ^= randomState >> 12;
+  randomState ^= randomState << 25;
+  randomState ^= randomState >> 27;
+  return (randomState * 2685821657736338717ULL >> 11) * (1.0 / 9007199254740992.0);
+}
+//
+//  Time to the next of a Poisson process of rate events per day.
+//
+static uint64_t soakInterval(double rate)
+{
+  if (rate <= 0)
+    return UINT64_MAX / 2;
+
+  return uint64_t(-log(1.0 - soakRandom()) / rate * 86400.0 * SOAK_SECOND);
+}
+//
+//  Scheduled air events, kept in time order.
+//
+static void soakSchedule(uint64_t time, uint8_t type)
+{
+  uint8_t i;
+
+  if (actionCount == SOAK_ACTIONS)
+    return;
+
+  for (i = actionCount; i > 0 && actions[i - 1].time > time; i--)
+    actions[i] = actions[i - 1];
+
+  actions[i].time = time;
+  actions[i].type = type;
+  actionCount++;
+}
+
+static SoakAction soakNext(void)
+{
+  SoakAction next = actions[0];
+
+  actionCount--;
+  memmove(&actions[0], &actions[1], actionCount * sizeof(SoakAction));
+
+  return next;
+}
+//
+//  Returns 1 if a burst from burstStart to now overlapped a fade.
+//
+static uint8_t soakDamaged(uint64_t now)
+{
+  return fadeStart < now && fadeEnd > burstStart;
+}
+//
+//  Puts a new alert on the air, with its whole sequence.
+//
+static void soakAlert(uint64_t now, uint8_t repeat)
+{
+  uint64_t headerTime, eomTime, t = now;
+  uint32_t day = uint32_t(now / (86400 * SOAK_SECOND));
+  uint32_t minute = uint32_t(now / (60 * SOAK_SECOND)) % 1440;
+  uint8_t i;
+
+  if (!repeat)                                   //  A repeat is the same Header, issue time and all.
+    {
+      alertTime = minute / 60 * 100 + minute % 60;
+
+      snprintf(header, sizeof(header), "-WXR-%s-0%05u-0%05u+0030-%03u%04u-KSOAK%03u-",
+               soakEvents[uint32_t(soakRandom() * 8)], uint32_t(soakRandom() * 99999),
+               uint32_t(soakRandom() * 99999), day % 366 + 1, alertTime, day % 1000);
+    }
+
+  headerTime = (16 + 4 + strlen(header)) * 8 * SOAK_BIT;  //  Preamble, ZCZC and the Header.
+  eomTime = (16 + 4) * 8 * SOAK_BIT;
+
+  for (i = 0; i < 3; i++, t += headerTime + SOAK_SECOND)
+    {
+      soakSchedule(t, ACT_PREAMBLE);
+      soakSchedule(t + headerTime, ACT_HEADER);
+    }
+
+  if (soakRandom() < 0.5)
+    {
+      soakSchedule(t, ACT_TONE_ON);
+      soakSchedule(t + 8 * SOAK_SECOND, ACT_TONE_OFF);
+      t += 9 * SOAK_SECOND;
+    }
+
+  t += uint64_t((20 + soakRandom() * 40) * SOAK_SECOND);
+
+  for (i = 0; i < 3; i++, t += eomTime + SOAK_SECOND)
+    {
+      soakSchedule(t, ACT_PREAMBLE);
+      soakSchedule(t + eomTime, ACT_EOM);
+    }
+
+  soakSchedule(t + (SAME_TIME_OUT + 1) * SOAK_SECOND, ACT_CHECK);
+
+  if (repeat)
+    result->repeats++;
+  else
+    result->alerts++;
+
+  alertRepeat = repeat;
+  alertActive = 1;
+  alertClean = alertParsed = eomSeen = 0;
+  alertDecodable = 0;
+}
+//
+//  The driver restarts, as the sketch's setup() after a reset:  RAM is lost,
+//  the Si4707 is reset, and the log and channel history are recovered from
+//  storage.  Counts a restart that recovers them wrong.
+//
+static void soakRestart(const SoakOptions &options)
+{
+  uint16_t before = channel;
+  uint8_t i, n, type, wrong = 0;
+  uint8_t table[WB_CHANNELS * sizeof(ChannelRecord)];
+  ChannelRecord stored;
+  SameRecord record;
+
+  intStatus = msgStatus = 0;
+  sameMessageState = SAME_IDLE;
+  power = OFF;
+  Radio.dedupClear();
+  Radio.historyClear();
+
+  radio.reset();
+  radio.signal(baseRssi, baseSnr, 0);
+
+  Radio.begin();
+  Radio.logRecover();
+  Radio.execute(soakBoot);
+
+  n = Radio.logCount();
+
+  if (n != (loggedCount < Radio.logCapacity() ? loggedCount : Radio.logCapacity()))
+    wrong = 1;
+
+  for (i = 0; i < n && !wrong; i++)
+    if (Radio.logRead(i, &type, &record, sizeof(record)) != sizeof(record) || type != LOG_ALERT ||
+        record.hash != logged[(loggedCount - 1 - i) % SOAK_LOGGED])
+      wrong = 1;
+
+  memcpy(table, &nvMemory[NV_CHANNEL_START], sizeof(table));
+  memcpy(&stored, &table[(before - WB_MIN_FREQUENCY) / WB_CHANNEL_SPACING * sizeof(ChannelRecord)], sizeof(stored));
+
+  if (channelHeard && (crc16(table, sizeof(table)) != (nvMemory[NV_CHANNEL_START + sizeof(table)] << 8 |
+                                                       nvMemory[NV_CHANNEL_START + sizeof(table) + 1]) ||
+                       stored.sameTime != channelHeard))
+    wrong = 1;
+
+  if (Radio.tuneBest())                          //  After a SAME the history must bring it back to that channel,
+    wrong |= (channelHeard && radio.tunedChannel() != before);
+
+  else if (channelHeard && stored.rssi >= CHANNEL_MIN_RSSI && stored.snr >= CHANNEL_MIN_SNR)
+    wrong = 1;
+
+  if (channel != before)                         //  or there is none worth using, stay on it as soak starts.
+    {
+      channel = before;
+      Radio.tune();
+    }
+
+  Radio.rsqBegin(soakProfile.rsqSources);
+  Radio.frontBegin(options.policy, 10);
+
+  result->restarts++;
+  result->restartsWrong += wrong;
+}
+//
+//  Plays one air event.
+//
+static void soakAct(SoakAction action, const SoakOptions &options)
+{
+  uint64_t now = action.time;
+  uint8_t damaged;
+
+  switch (action.type)
+    {
+      case ACT_ALERT:
+                soakAlert(now, 0);
+                break;
+
+      case ACT_REPEAT:
+                repeatPending = 0;
+                soakAlert(now, 1);
+                break;
+
+      case ACT_PREAMBLE:
+                burstStart = now;
+                if (!soakDamaged(now))
+                  radio.samePreamble();
+                break;
+
+      case ACT_HEADER:
+                damaged = soakDamaged(now);
+                radio.sameHeader(header, damaged);
+
+                if (!damaged && !alertClean)
+                  {
+                    alertClean = 1;
+                    alertDecodable = now;
+                  }
+                break;
+
+      case ACT_EOM:
+                if (!soakDamaged(now) && !eomSeen)
+                  {
+                    eomSeen = 1;
+                    radio.sameEom();
+                  }
+                break;
+
+      case ACT_TONE_ON:
+      case ACT_TONE_OFF:
+                radio.alertTone(action.type == ACT_TONE_ON);
+                break;
+
+      case ACT_CHECK:
+                if (alertRepeat)
+                  result->repeatsHeard += alertClean;
+
+                else if (!alertParsed)
+                  {
+                    if (alertClean)
+                      result->missed++;
+                    else
+                      result->lost++;
+                  }
+
+                alertActive = 0;
+
+                if (!alertRepeat && alertParsed && soakRandom() < options.repeatRate)
+                  {
+                    repeatPending = 1;
+                    soakSchedule(now + uint64_t((60 + soakRandom() * 240) * SOAK_SECOND), ACT_REPEAT);
+                  }
+
+                else
+                  soakSchedule(now + soakInterval(options.alertRate), ACT_ALERT);  //  One alert on the air at a time.
+                break;
+
+      case ACT_FADE_ON:
+                if (fadeEnd <= now)
+                  {
+                    fadeStart = now;
+                    fadeEnd = now + uint64_t((1 + soakRandom() * 19) * SOAK_SECOND);
+                    radio.signal(baseRssi / 4, 2, int8_t(soakRandom() * 30 - 15));
+                    soakSchedule(fadeEnd, ACT_FADE_OFF);
+                  }
+                soakSchedule(now + soakInterval(options.fadeRate), ACT_FADE_ON);
+                break;
+
+      case ACT_FADE_OFF:
+                radio.signal(baseRssi, baseSnr, 0);
+                break;
+
+      case ACT_FAULT_ON:
+                if (!faultActive)
+                  {
+                    faultActive = 1;
+                    radio.fault(FAULT_NACK + uint8_t(soakRandom() * 3));
+                    soakSchedule(now + uint64_t((0.01 + soakRandom() * 1.99) * SOAK_SECOND), ACT_FAULT_OFF);
+                  }
+                soakSchedule(now + soakInterval(options.faultRate), ACT_FAULT_ON);
+                break;
+
+      case ACT_FAULT_OFF:
+                faultActive = 0;
+                radio.fault(FAULT_NONE);
+                break;
+
+      case ACT_RESTART:
+                if (alertActive || repeatPending || faultActive || fadeEnd > now || Radio.logService() || Radio.tick())
+                  {
+                    soakSchedule(now + 60 * SOAK_SECOND, ACT_RESTART);  //  Not while anything is in flight.
+                    break;
+                  }
+
+                soakRestart(options);
+                soakSchedule(now + soakInterval(options.restartRate), ACT_RESTART);
+                break;
+    }
+}
+//
+//  A parse happened, is it the alert on the air?
+//
+static void soakParsed(void)
+{
+  if (!alertActive || alertRepeat || alertParsed || strncmp(&header[5], sameEventName, 3) || sameTime != alertTime)
+    {
+      result->strays++;
+      return;
+    }
+
+  alertParsed = 1;
+  result->delivered++;
+
+  if (result->latencyCount < SOAK_LATENCIES)
+    result->latency[result->latencyCount++] = uint32_t((clockMicros() - alertDecodable) / 1000);
+}
+//
+//  Status bits are processed here once tick() has read them, as the example sketch does.
+//
+static void soakStatus(void)
+{
+  uint8_t status = statusRead;
+
+  statusRead = 0x00;
+
+  if (status & SAMEINT && !(sameStatus & EOMDET))
+    {
+      if (msgStatus & MSGAVL && (!(msgStatus & MSGUSD)))
+        Radio.sameParse();
+
+      if (msgStatus & MSGDUP)
+        {
+          msgStatus &= ~MSGDUP;
+          result->duplicates++;
+        }
+
+      if (msgStatus & MSGPAR)
+        {
+          msgStatus &= ~MSGPAR;
+          logged[loggedCount++ % SOAK_LOGGED] = sameHash;
+
+          if (!channelHeard)
+            channelHeard = Time.now();
+
+          soakParsed();
+        }
+    }
+}
+//
+//  The interrupt handler, as the example sketch's intSet().  The emulator
+//  calls it on the line's edges only, even in the middle of a transfer.
+//
+static void soakInterrupt(void)
+{
+  intStatus |= INTAVL;
+}
+//
+//  The air does not wait for the driver.  Events due within -m msec are
+//  played right after a read, so the interrupt lands after the Si4707
+//  answered but before the driver has taken the status from the answer.
+//
+static int soakTransfer(struct i2c_msg *msgs, uint32_t count)
+{
+  int status = radio.transfer(msgs, count);
+  uint64_t due = clockMicros() + soakOptions->midWindow * 1000ULL;
+
+  if (!(msgs[count - 1].flags & I2C_M_RD))
+    return status;
+
+  while (actionCount && actions[0].time <= due && actions[0].type != ACT_RESTART)
+    soakAct(soakNext(), *soakOptions);
+
+  return status;
+}
+
+static uint8_t soakNvRead(uint16_t address)
+{
+  return nvMemory[address % EEPROM_SIZE];
+}
+
+static void soakNvWrite(uint16_t address, uint8_t value)
+{
+  nvMemory[address % EEPROM_SIZE] = value;
+}
+//
+//  Runs one receiver for the whole period, in its own process.
+//
+static void soakReceiver(uint32_t id, const SoakOptions &options)
+{
+  struct timespec cpu;
+  uint64_t end, now, target;
+  uint8_t events, busy;
+
+  randomState = (uint64_t(options.seed) << 32 | id) * 0x9E3779B97F4A7C15ULL | 1;
+  baseRssi = 25 + uint8_t(soakRandom() * 35);
+  baseSnr = 8 + uint8_t(soakRandom() * 22);
+
+  soakOptions = &options;
+  hostBegin();
+  clockVirtual();
+  radio.reset();
+  radio.attach(soakInterrupt);
+  radio.signal(baseRssi, baseSnr, 0);
+  busBackend(soakTransfer);
+  memset(nvMemory, 0xFF, sizeof(nvMemory));
+  Radio.nvBackend(soakNvRead, soakNvWrite, sizeof(nvMemory));
+
+  Radio.begin();
+  Wire.begin();
+  Radio.execute(soakBoot);
+  Radio.rsqBegin(soakProfile.rsqSources);
+  Radio.frontBegin(options.policy, 10);
+
+  now = clockMicros();
+  end = now + options.days * 86400 * SOAK_SECOND;
+  fadeStart = fadeEnd = 0;
+
+  soakSchedule(now + soakInterval(options.alertRate), ACT_ALERT);
+  soakSchedule(now + soakInterval(options.fadeRate), ACT_FADE_ON);
+  soakSchedule(now + soakInterval(options.faultRate), ACT_FAULT_ON);
+  soakSchedule(now + soakInterval(options.restartRate), ACT_RESTART);
+
+  while (now < end)
+    {
+      while (actionCount && actions[0].time <= now)
+        soakAct(soakNext(), options);
+
+      busy = Radio.tick();
+
+      if (statusRead)
+        soakStatus();
+
+      Radio.sameService();
+
+      if (Radio.rsqService())
+        result->rsqReports++;
+
+      events = Radio.frontService();
+
+      if (events & FRONT_RELOCKED && result->relockCount < SOAK_LATENCIES)
+        result->relock[result->relockCount++] = relockTime;
+
+      if (events & FRONT_DECODED && result->decodeCount < SOAK_LATENCIES)
+        result->decode[result->decodeCount++] = decodeTime;
+
+      Radio.logService();
+
+      now = clockMicros();
+      target = actionCount ? actions[0].time : end;
+
+      if (alertActive || faultActive || fadeEnd > now || !(rsqValid & VALID) || rsqValid & AFCRL ||
+          !radio.property(WB_RSQ_INT_SOURCE) || sameMessageState != SAME_IDLE || intStatus & INTAVL)
+        target = (now + SOAK_STEP < target) ? now + SOAK_STEP : target;
+
+      if (busy || intStatus & INTAVL)
+        target = (now + SOAK_TICK < target) ? now + SOAK_TICK : target;
+
+      if (target > now)
+        clockAdvance(target - now);
+
+      now = clockMicros();
+    }
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+  result->cpuMicros = uint64_t(cpu.tv_sec) * 1000000 + cpu.tv_nsec / 1000;
+  result->i2cErrors = i2cErrors;
+  result->i2cRetries = i2cRetries;
+  result->i2cRecoveries = i2cRecoveries;
+  result->done = 1;
+}
+//
+static int soakCompare(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+static uint32_t soakPercentile(const uint32_t *sorted, uint32_t count, uint32_t percent)
+{
+  return count ? sorted[(uint64_t(count) * percent - 1) / 100] : 0;
+}
+//
+//  Forks the receivers, at most jobs at a time, and reports.
+//
+int main(int argc, char *argv[])
+{
+  SoakOptions options = { 100, 365, uint32_t(sysconf(_SC_NPROCESSORS_ONLN)), 1, 2.0, 6.0, 4.0, 0.25, 1.0, 10,
+                          FRONT_AGC_FREEZE | FRONT_AFC_RETUNE, 0 };
+  SoakResult *results, total;
+  struct timespec start, finish;
+  uint32_t i, running = 0, next = 0, failed = 0;
+  uint32_t *latencies, latencyCount = 0;
+  uint32_t *relocks, relockCount = 0, *decodes, decodeCount = 0;
+  uint64_t cpu = 0;
+  double wall;
+  int option;
+
+  while ((option = getopt(argc, argv, "n:d:j:s:a:f:b:r:R:m:p:q")) != -1)
+    switch (option)
+      {
+        case 'n':  options.receivers = atoi(optarg);  break;
+        case 'd':  options.days = atoi(optarg);       break;
+        case 'j':  options.jobs = atoi(optarg);       break;
+        case 's':  options.seed = atoi(optarg);       break;
+        case 'a':  options.alertRate = atof(optarg);  break;
+        case 'f':  options.fadeRate = atof(optarg);   break;
+        case 'b':  options.faultRate = atof(optarg);  break;
+        case 'r':  options.repeatRate = atof(optarg); break;
+        case 'R':  options.restartRate = atof(optarg); break;
+        case 'm':  options.midWindow = atoi(optarg);  break;
+        case 'p':  options.policy = atoi(optarg);     break;
+        case 'q':  options.quiet = 1;                 break;
+        default:
+                  fprintf(stderr, "usage: %s [-n receivers] [-d days] [-j jobs] [-s seed] [-a alerts/day] [-f fades/day] [-b faults/day] [-r repeat probability] [-R restarts/day] [-m msec] [-p policy] [-q]\n", argv[0]);
+                  return 2;
+      }
+
+  if (!options.receivers || !options.jobs)
+    return 2;
+
+  results = (SoakResult *) mmap(NULL, options.receivers * sizeof(SoakResult), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (results == MAP_FAILED)
+    return 2;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  while (next < options.receivers || running)
+    {
+      if (next < options.receivers && running < options.jobs)
+        {
+          pid_t pid = fork();
+
+          if (pid == 0)
+            {
+              result = &results[next];
+              soakReceiver(next, options);
+              _exit(0);
+            }
+
+          if (pid > 0)
+            running++;
+
+          next++;
+          continue;
+        }
+
+      if (wait(NULL) > 0)
+        running--;
+    }
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+  wall = (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec) / 1e9;
+
+  memset(&total, 0, sizeof(total));
+  latencies = (uint32_t *) malloc(options.receivers * SOAK_LATENCIES * sizeof(uint32_t));
+  relocks = (uint32_t *) malloc(options.receivers * SOAK_LATENCIES * sizeof(uint32_t));
+  decodes = (uint32_t *) malloc(options.receivers * SOAK_LATENCIES * sizeof(uint32_t));
+
+  if (!options.quiet)
+    printf("%5s %7s %7s %6s %5s %5s %5s %6s %6s %6s %8s %5s %5s %5s %8s\n", "RX", "ALERTS", "PARSED", "MISSED", "LOST",
+           "DUPS", "STRAY", "P50ms", "P95ms", "P99ms", "MAXms", "I2CE", "RETRY", "RECOV", "CPUms");
+
+  for (i = 0; i < options.receivers; i++)
+    {
+      SoakResult &r = results[i];
+
+      if (!r.done)
+        {
+          printf("%5u did not finish\n", i);
+          failed++;
+          continue;
+        }
+
+      qsort(r.latency, r.latencyCount, sizeof(uint32_t), soakCompare);
+
+      if (!options.quiet)
+        printf("%5u %7u %7u %6u %5u %5u %5u %6u %6u %6u %8u %5u %5u %5u %8llu\n", i, r.alerts, r.delivered, r.missed, r.lost,
+               r.duplicates, r.strays, soakPercentile(r.latency, r.latencyCount, 50),
+               soakPercentile(r.latency, r.latencyCount, 95), soakPercentile(r.latency, r.latencyCount, 99),
+               r.latencyCount ? r.latency[r.latencyCount - 1] : 0, r.i2cErrors, r.i2cRetries, r.i2cRecoveries,
+               (unsigned long long) (r.cpuMicros / 1000));
+
+      total.alerts += r.alerts;
+      total.delivered += r.delivered;
+      total.missed += r.missed;
+      total.lost += r.lost;
+      total.duplicates += r.duplicates;
+      total.strays += r.strays;
+      total.repeats += r.repeats;
+      total.repeatsHeard += r.repeatsHeard;
+      total.restarts += r.restarts;
+      total.restartsWrong += r.restartsWrong;
+      cpu += r.cpuMicros;
+
+      if (latencies)
+        {
+          memcpy(&latencies[latencyCount], r.latency, r.latencyCount * sizeof(uint32_t));
+          latencyCount += r.latencyCount;
+        }
+
+      if (relocks)
+        {
+          memcpy(&relocks[relockCount], r.relock, r.relockCount * sizeof(uint32_t));
+          relockCount += r.relockCount;
+        }
+
+      if (decodes)
+        {
+          memcpy(&decodes[decodeCount], r.decode, r.decodeCount * sizeof(uint32_t));
+          decodeCount += r.decodeCount;
+        }
+    }
+
+  if (latencies)
+    qsort(latencies, latencyCount, sizeof(uint32_t), soakCompare);
+
+  if (relocks)
+    qsort(relocks, relockCount, sizeof(uint32_t), soakCompare);
+
+  if (decodes)
+    qsort(decodes, decodeCount, sizeof(uint32_t), soakCompare);
+
+  printf("\n%u receivers x %u days: %u alerts, %u parsed, %u missed, %u lost on the air, %u duplicates, %u stray\n",
+         options.receivers, options.days, total.alerts, total.delivered, total.missed, total.lost, total.duplicates, total.strays);
+  printf("Repeated %u alerts, %u with a clean Header, %u duplicates; restarted %u times, %u recovered wrong\n",
+         total.repeats, total.repeatsHeard, total.duplicates, total.restarts, total.restartsWrong);
+  printf("Latency p50 %u ms, p95 %u ms, p99 %u ms, max %u ms\n", soakPercentile(latencies, latencyCount, 50),
+         soakPercentile(latencies, latencyCount, 95), soakPercentile(latencies, latencyCount, 99),
+         latencyCount ? latencies[latencyCount - 1] : 0);
+  printf("Relock %u times, p50 %u ms, p95 %u ms, max %u ms; decode after relock %u times, p50 %u ms, p95 %u ms\n",
+         relockCount, soakPercentile(relocks, relockCount, 50), soakPercentile(relocks, relockCount, 95),
+         relockCount ? relocks[relockCount - 1] : 0, decodeCount, soakPercentile(decodes, decodeCount, 50),
+         soakPercentile(decodes, decodeCount, 95));
+  printf("CPU %.1f s (%.1f ms per receiver-day), wall %.1f s, %.0f receiver-days per second\n", cpu / 1e6,
+         cpu / 1e3 / (double(options.receivers) * options.days), wall, options.receivers * options.days / wall);
+
+  free(latencies);
+  free(relocks);
+  free(decodes);
+  return (total.missed || failed || total.duplicates != total.repeatsHeard || total.restartsWrong) ? 1 : 0;
+}
+
+#endif  //  __linux__
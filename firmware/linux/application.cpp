@@ -0,0 +1,535 @@
+/*
+  application.cpp - The part of the Spark Core API used by the SI4707 library, for Linux.
+
+  Copyright 2013 by Ray H. Dees
+  Copyright 2013 by AIW Industries, LLC
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#if defined(__linux__)
+
+#include "application.h"
+#include "SI4707Bus.h"
+#include <atomic>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+//
+SerialPort Serial;
+TwoWire Wire;
+EEPROMClass EEPROM;
+TimeClass Time;
+//
+static struct timespec startTime;
+static int gpioChip = -1;
+static int lineOffset[PIN_COUNT];                //  GPIO line of each pin, -1 if none.
+static int lineFd[PIN_COUNT];
+static uint64_t lineFlags[PIN_COUNT];
+static int eepromFd = -1;
+static uint8_t eeprom[EEPROM_SIZE];
+static uint8_t virtualClock;
+static std::atomic<uint64_t> virtualMicros(0);   //  Also read by the bus worker, through a BusTransfer.
+//
+//  Reads SI4707_LINES and starts the clock.  Called by main() before setup().
+//
+void hostBegin(void)
+{
+  const char *lines = getenv("SI4707_LINES");
+  int pin, line, used;
+  uint8_t i;
+
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+  for (i = 0; i < PIN_COUNT; i++)
+    {
+      lineOffset[i] = -1;
+      lineFd[i] = -1;
+    }
+
+  while (lines && sscanf(lines, "%d:%d%n", &pin, &line, &used) == 2)
+    {
+      if (pin >= 0 && pin < PIN_COUNT)
+        lineOffset[pin] = line;
+
+      lines += used;
+      lines += (*lines == ',');
+    }
+}
+//
+//  Timing.
+//
+static uint64_t hostMicros(void)
+{
+  struct timespec now;
+
+  if (virtualClock)
+    return virtualMicros.load(std::memory_order_relaxed);
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return uint64_t(now.tv_sec - startTime.tv_sec) * 1000000ULL + (now.tv_nsec - startTime.tv_nsec) / 1000;
+}
+
+uint32_t millis(void)
+{
+  return uint32_t(hostMicros() / 1000);
+}
+
+uint32_t micros(void)
+{
+  return uint32_t(hostMicros());
+}
+//
+//  Stops millis() and micros() following the wall clock.  From here on only
+//  delay(), delayMicroseconds() and clockAdvance() move them, so a harness
+//  can run days of driver time in moments.
+//
+void clockVirtual(void)
+{
+  virtualMicros.store(hostMicros());
+  virtualClock = 1;
+}
+
+void clockAdvance(uint64_t us)
+{
+  virtualMicros.fetch_add(us, std::memory_order_relaxed);
+}
+//
+//  micros() without the wrap.
+//
+uint64_t clockMicros(void)
+{
+  return hostMicros();
+}
+//
+//  An interrupt during a delay() is held for the next pass of loop(), so the
+//  handler never runs in the middle of a driver transaction.
+//
+void delay(uint32_t ms)
+{
+  struct timespec wait;
+
+  if (virtualClock)
+    {
+      clockAdvance(ms * 1000ULL);
+      return;
+    }
+
+  wait.tv_sec = ms / 1000;
+  wait.tv_nsec = (ms % 1000) * 1000000L;
+  nanosleep(&wait, NULL);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+  struct timespec wait;
+
+  if (virtualClock)
+    {
+      clockAdvance(us);
+      return;
+    }
+
+  wait.tv_sec = us / 1000000;
+  wait.tv_nsec = (us % 1000000) * 1000L;
+  nanosleep(&wait, NULL);
+}
+//
+//  Requests a pin's GPIO line with new flags.  Returns its fd, or -1 if it has no line.
+//
+static int lineRequest(uint16_t pin, uint64_t flags)
+{
+  struct gpio_v2_line_request request;
+  const char *path = getenv("SI4707_GPIOCHIP");
+
+  if (pin >= PIN_COUNT || lineOffset[pin] < 0)
+    return -1;
+
+  if (gpioChip < 0)
+    gpioChip = open(path ? path : "/dev/gpiochip0", O_RDWR | O_CLOEXEC);
+
+  if (gpioChip < 0)
+    return -1;
+
+  if (lineFd[pin] >= 0)
+    close(lineFd[pin]);
+
+  memset(&request, 0, sizeof(request));
+  request.offsets[0] = lineOffset[pin];
+  request.num_lines = 1;
+  request.config.flags = flags;
+  strncpy(request.consumer, "si4707", sizeof(request.consumer) - 1);
+
+  lineFd[pin] = (ioctl(gpioChip, GPIO_V2_GET_LINE_IOCTL, &request) < 0) ? -1 : request.fd;
+  lineFlags[pin] = flags;
+
+  return lineFd[pin];
+}
+
+void pinMode(uint16_t pin, uint8_t mode)
+{
+  uint64_t flags = GPIO_V2_LINE_FLAG_INPUT;
+
+  if (mode == OUTPUT)
+    flags = GPIO_V2_LINE_FLAG_OUTPUT;
+
+  else if (mode == INPUT_PULLUP)
+    flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+
+  else if (mode == INPUT_PULLDOWN)
+    flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN;
+
+  lineRequest(pin, flags);
+}
+
+void digitalWrite(uint16_t pin, uint8_t value)
+{
+  struct gpio_v2_line_values values;
+
+  if (pin >= PIN_COUNT || lineFd[pin] < 0)
+    return;
+
+  values.bits = value ? 1 : 0;
+  values.mask = 1;
+  ioctl(lineFd[pin], GPIO_V2_LINE_SET_VALUES_IOCTL, &values);
+}
+
+int32_t digitalRead(uint16_t pin)
+{
+  struct gpio_v2_line_values values;
+
+  if (pin >= PIN_COUNT || lineFd[pin] < 0)
+    return HIGH;
+
+  values.mask = 1;
+
+  if (ioctl(lineFd[pin], GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+    return HIGH;
+
+  return (values.bits & 1) ? HIGH : LOW;
+}
+//
+//  The handler runs on the application thread, from delay(), a Wire transfer
+//  or between passes of loop(), never part way through other code.
+//
+bool attachInterrupt(uint16_t pin, void (*handler)(void), uint8_t mode)
+{
+  uint64_t flags = GPIO_V2_LINE_FLAG_INPUT;
+
+  if (pin >= PIN_COUNT)
+    return false;
+
+  if (lineFd[pin] >= 0)
+    flags = lineFlags[pin] & ~GPIO_V2_LINE_FLAG_OUTPUT;
+
+  if (mode == FALLING || mode == CHANGE)
+    flags |= GPIO_V2_LINE_FLAG_EDGE_FALLING;
+
+  if (mode == RISING || mode == CHANGE)
+    flags |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+
+  busAttach(lineRequest(pin, flags), handler);
+  return true;
+}
+
+void detachInterrupt(uint16_t pin)
+{
+  busAttach(-2, NULL);
+
+  if (pin < PIN_COUNT && lineFd[pin] >= 0)
+    lineRequest(pin, lineFlags[pin] & ~(GPIO_V2_LINE_FLAG_EDGE_FALLING | GPIO_V2_LINE_FLAG_EDGE_RISING));
+}
+
+void noInterrupts(void)
+{
+  busMask(1);
+}
+
+void interrupts(void)
+{
+  busMask(0);
+}
+//
+//  Print.
+//
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+
+  while (size--)
+    n += write(*buffer++);
+
+  return n;
+}
+
+size_t Print::print(const char *s)
+{
+  return write((const uint8_t *) s, strlen(s));
+}
+
+size_t Print::print(char c)
+{
+  return write(uint8_t(c));
+}
+
+size_t Print::print(unsigned char n, int base)
+{
+  return printNumber(n, base);
+}
+
+size_t Print::print(int n, int base)
+{
+  return print(long(n), base);
+}
+
+size_t Print::print(unsigned int n, int base)
+{
+  return printNumber(n, base);
+}
+
+size_t Print::print(long n, int base)
+{
+  if (n < 0 && base == DEC)
+    return print('-') + printNumber(0UL - (unsigned long) n, base);
+
+  return printNumber(n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+  return printNumber(n, base);
+}
+
+size_t Print::print(double n, int digits)
+{
+  char text[32];
+
+  snprintf(text, sizeof(text), "%.*f", digits, n);
+  return print(text);
+}
+
+size_t Print::println(void)
+{
+  return print("\r\n");
+}
+
+size_t Print::printNumber(unsigned long n, uint8_t base)
+{
+  char text[sizeof(n) * 8 + 1];
+  char *s = &text[sizeof(text) - 1];
+
+  if (base < 2)
+    base = 10;
+
+  *s = 0;
+
+  do
+    {
+      *--s = "0123456789ABCDEF"[n % base];
+      n /= base;
+    }
+  while (n);
+
+  return print(s);
+}
+//
+//  Serial.
+//
+void SerialPort::begin(uint32_t baud)
+{
+  (void) baud;                                   //  stdout has no baud rate.
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+}
+
+int SerialPort::available(void)
+{
+  struct pollfd fd;
+  uint8_t c;
+
+  if (pending >= 0)
+    return 1;
+
+  fd.fd = STDIN_FILENO;
+  fd.events = POLLIN;
+
+  if (poll(&fd, 1, 0) <= 0 || ::read(STDIN_FILENO, &c, 1) != 1)
+    return 0;
+
+  pending = c;
+  return 1;
+}
+
+int SerialPort::read(void)
+{
+  int c = peek();
+
+  pending = -1;
+  return c;
+}
+
+int SerialPort::peek(void)
+{
+  return available() ? pending : -1;
+}
+
+void SerialPort::flush(void)
+{
+  fflush(stdout);
+}
+
+size_t SerialPort::write(uint8_t c)
+{
+  return fwrite(&c, 1, 1, stdout);
+}
+
+size_t SerialPort::write(const uint8_t *buffer, size_t size)
+{
+  return fwrite(buffer, 1, size, stdout);
+}
+//
+//  Wire.
+//
+void TwoWire::begin(void)
+{
+  enabled = busBegin();
+}
+
+void TwoWire::end(void)
+{
+  busEnd();
+  enabled = 0;
+}
+
+bool TwoWire::isEnabled(void)
+{
+  return enabled;
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+  this->address = address;
+  txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+  if (txLength >= sizeof(txBuffer))
+    return 0;
+
+  txBuffer[txLength++] = data;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t quantity)
+{
+  size_t n = 0;
+
+  while (n < quantity && write(data[n]))
+    n++;
+
+  return n;
+}
+
+uint8_t TwoWire::endTransmission(uint8_t stop)
+{
+  (void) stop;                                   //  Every write ends with a STOP.
+  return busTransfer(address, txBuffer, txLength, NULL, 0);
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint8_t stop)
+{
+  (void) stop;                                   //  Every read ends with a STOP.
+  rxIndex = 0;
+  rxLength = 0;
+
+  if (quantity > sizeof(rxBuffer))
+    quantity = sizeof(rxBuffer);
+
+  if (busTransfer(address, NULL, 0, rxBuffer, quantity) == BUS_OK)
+    rxLength = quantity;
+
+  return rxLength;
+}
+
+int TwoWire::available(void)
+{
+  return rxLength - rxIndex;
+}
+
+int TwoWire::read(void)
+{
+  return (rxIndex < rxLength) ? rxBuffer[rxIndex++] : -1;
+}
+//
+//  EEPROM, read whole on first use and written through a byte at a time.
+//
+static uint8_t eepromOpen(void)
+{
+  const char *path = getenv("SI4707_EEPROM");
+  ssize_t n;
+
+  if (eepromFd >= 0)
+    return 1;
+
+  eepromFd = open(path ? path : "si4707.eeprom", O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+  if (eepromFd < 0)
+    return 0;
+
+  memset(eeprom, 0xFF, sizeof(eeprom));          //  Erased, as a new part.
+  n = pread(eepromFd, eeprom, sizeof(eeprom), 0);
+
+  if (n >= 0 && n < EEPROM_SIZE)
+    n = pwrite(eepromFd, &eeprom[n], EEPROM_SIZE - n, n);
+
+  return (n >= 0);
+}
+
+uint8_t EEPROMClass::read(int address)
+{
+  if (address < 0 || address >= EEPROM_SIZE || !eepromOpen())
+    return 0xFF;
+
+  return eeprom[address];
+}
+
+void EEPROMClass::write(int address, uint8_t value)
+{
+  if (address < 0 || address >= EEPROM_SIZE || !eepromOpen())
+    return;
+
+  eeprom[address] = value;
+
+  if (pwrite(eepromFd, &value, 1, address) != 1)
+    return;
+}
+//
+//  Time.
+//
+uint32_t TimeClass::now(void)
+{
+  static uint32_t epoch = uint32_t(time(NULL));
+
+  if (virtualClock)
+    return epoch + uint32_t(hostMicros() / 1000000);
+
+  return uint32_t(time(NULL));
+}
+
+#endif  //  __linux__
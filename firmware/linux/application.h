@@ -0,0 +1,221 @@
+/*
+  application.h - The part of the Spark Core API used by the SI4707 library, for Linux.
+
+  Copyright 2013 by Ray H. Dees
+  Copyright 2013 by AIW Industries, LLC
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+  Lets SI4707.cpp and a sketch run unchanged on a Linux gateway, with the
+  Si4707 on the host's I2C bus (see SI4707Bus.h) and its pins on a GPIO
+  character device.  Put this directory ahead of the firmware directory on
+  the include path:
+
+    g++ -std=gnu++11 -O2 -Ifirmware/linux -Ifirmware -x c++ firmware/examples/SI4707.ino \
+        -x none firmware/SI4707.cpp firmware/linux/main.cpp firmware/linux/application.cpp \
+        firmware/linux/SI4707Bus.cpp -pthread -o si4707
+
+  Environment:
+
+    SI4707_I2C          I2C bus, default /dev/i2c-1.
+    SI4707_GPIOCHIP     GPIO chip, default /dev/gpiochip0.
+    SI4707_LINES        Pins to GPIO lines, "pin:line,..." e.g. "2:17,4:27" for INT and RST.
+                        Unlisted pins do nothing, and read HIGH.  With no line for the
+                        interrupt pin, the interrupt handler is called every BUS_POLL_INTERVAL.
+    SI4707_EEPROM       File holding the EEPROM, default si4707.eeprom.
+
+  Serial is stdin and stdout.
+*/
+#ifndef application_h
+#define application_h
+//
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+//
+typedef uint8_t byte;
+typedef bool boolean;
+//
+#define F(x)                              (x)
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+//
+#define LOW                               0
+#define HIGH                              1
+#define INPUT                             0
+#define OUTPUT                            1
+#define INPUT_PULLUP                      2
+#define INPUT_PULLDOWN                    3
+#define CHANGE                            1
+#define RISING                            2
+#define FALLING                           3
+//
+#define D0                                0
+#define D1                                1
+#define D2                                2
+#define D3                                3
+#define D4                                4
+#define D5                                5
+#define D6                                6
+#define D7                                7
+#define A0                               10
+#define A1                               11
+#define A2                               12
+#define A3                               13
+#define A4                               14
+#define A5                               15
+#define A6                               16
+#define A7                               17
+#define SDA                              D0
+#define SCL                              D1
+#define PIN_COUNT                        18
+//
+#define DEC                              10
+#define HEX                              16
+#define OCT                               8
+#define BIN                               2
+#define EEPROM_SIZE                    2048
+//
+//  The sketch.
+//
+void setup(void);
+void loop(void);
+//
+//  Timing, pins and interrupts.
+//
+uint32_t millis(void);
+uint32_t micros(void);
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void pinMode(uint16_t pin, uint8_t mode);
+void digitalWrite(uint16_t pin, uint8_t value);
+int32_t digitalRead(uint16_t pin);
+bool attachInterrupt(uint16_t pin, void (*handler)(void), uint8_t mode);
+void detachInterrupt(uint16_t pin);
+void noInterrupts(void);
+void interrupts(void);
+//
+//  Linux only.
+//
+void hostBegin(void);
+void clockVirtual(void);
+void clockAdvance(uint64_t us);
+uint64_t clockMicros(void);
+//
+//  Text output, as Arduino's Print.
+//
+class Print
+{
+  public:
+    virtual ~Print() { }
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+
+    size_t print(const char *s);
+    size_t print(char c);
+    size_t print(unsigned char n, int base = DEC);
+    size_t print(int n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(double n, int digits = 2);
+
+    template <typename T> size_t println(T value) { return print(value) + println(); }
+    template <typename T> size_t println(T value, int format) { return print(value, format) + println(); }
+    size_t println(void);
+
+  private:
+    size_t printNumber(unsigned long n, uint8_t base);
+};
+//
+//  Serial on stdin and stdout.
+//
+class SerialPort : public Print
+{
+  public:
+    void begin(uint32_t baud);
+    int available(void);
+    int read(void);
+    int peek(void);
+    void flush(void);
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+    operator bool() { return true; }
+
+  private:
+    int pending = -1;
+};
+//
+//  I2C, through the bus worker.  Every write and read ends with a STOP.
+//
+class TwoWire
+{
+  public:
+    void begin(void);
+    void end(void);
+    bool isEnabled(void);
+    void beginTransmission(uint8_t address);
+    size_t write(uint8_t data);
+    size_t write(const uint8_t *data, size_t quantity);
+    uint8_t endTransmission(uint8_t stop = true);
+    uint8_t requestFrom(uint8_t address, uint8_t quantity, uint8_t stop = true);
+    int available(void);
+    int read(void);
+
+  private:
+    uint8_t enabled = 0;
+    uint8_t address = 0;
+    uint8_t txLength = 0;
+    uint8_t txBuffer[32];
+    uint8_t rxLength = 0;
+    uint8_t rxIndex = 0;
+    uint8_t rxBuffer[32];
+};
+//
+//  EEPROM in a file.
+//
+class EEPROMClass
+{
+  public:
+    uint8_t read(int address);
+    void write(int address, uint8_t value);
+    size_t length(void) { return EEPROM_SIZE; }
+};
+//
+class TimeClass
+{
+  public:
+    uint32_t now(void);
+};
+//
+//  String, only as much as sameFill() needs.
+//
+class String
+{
+  public:
+    String(const char *s = "") : text(s) { }
+    unsigned int length(void) const { return strlen(text); }
+    char charAt(unsigned int i) const { return text[i]; }
+    char operator[](unsigned int i) const { return text[i]; }
+
+  private:
+    const char *text;
+};
+//
+extern SerialPort Serial;
+extern TwoWire Wire;
+extern EEPROMClass EEPROM;
+extern TimeClass Time;
+
+#endif  //  End of application.h
@@ -0,0 +1,40 @@
+/*
+  main.cpp - Runs a sketch on Linux, as the Spark Core firmware would.
+
+  Copyright 2013 by Ray H. Dees
+  Copyright 2013 by AIW Industries, LLC
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#if defined(__linux__)
+
+#include "application.h"
+#include "SI4707Bus.h"
+//
+//  The sketch runs as it would on the Core, with interrupts delivered between passes.
+//
+int main(void)
+{
+  hostBegin();
+  setup();
+
+  for (;;)
+    {
+      busDispatch();
+      loop();
+      busWait(1);                                //  Don't spin a core on an idle loop().
+    }
+}
+
+#endif  //  __linux__